@@ -0,0 +1,422 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MOCK_MAX_CONN 4096
+#define MOCK_MAX_PEER 4096
+
+typedef struct Peer {
+    char host[64];
+    char state[16];
+} Peer;
+
+typedef struct Step {
+    long at;
+    char host[64];
+    char state[16];
+    bool done;
+} Step;
+
+typedef struct Conn {
+    bool startup;
+    char *in;
+    char *out;
+    int fd;
+    long ready;
+    size_t in_len;
+    size_t in_size;
+    size_t out_len;
+    size_t out_size;
+    size_t out_sent;
+    unsigned query;
+} Conn;
+
+enum { query_other, query_probe, query_listen, query_read_only, query_ping };
+
+static char *mock_system_identifier = "0";
+static char *mock_timeline_id = "1";
+static Conn mock_conns[MOCK_MAX_CONN];
+static int mock_delay = 0;
+static int mock_drop = 0;
+static int mock_jitter = 0;
+static int mock_nconns = 0;
+static int mock_npeers = 0;
+static int mock_nsteps = 0;
+static Peer mock_peers[MOCK_MAX_PEER];
+static Step *mock_steps = NULL;
+static long mock_start;
+
+static long mock_clock(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static long mock_now(void) {
+    return mock_clock(CLOCK_MONOTONIC);
+}
+
+static void mock_reserve(Conn *conn, size_t len) {
+    if (conn->out_len + len <= conn->out_size) return;
+    conn->out_size = (conn->out_len + len) * 2;
+    if (!(conn->out = realloc(conn->out, conn->out_size))) { perror("realloc"); exit(1); }
+}
+
+static void mock_byte(Conn *conn, char c) {
+    mock_reserve(conn, 1);
+    conn->out[conn->out_len++] = c;
+}
+
+static void mock_int16(Conn *conn, uint16_t n) {
+    n = htons(n);
+    mock_reserve(conn, sizeof(n));
+    memcpy(conn->out + conn->out_len, &n, sizeof(n));
+    conn->out_len += sizeof(n);
+}
+
+static void mock_int32(Conn *conn, uint32_t n) {
+    n = htonl(n);
+    mock_reserve(conn, sizeof(n));
+    memcpy(conn->out + conn->out_len, &n, sizeof(n));
+    conn->out_len += sizeof(n);
+}
+
+static void mock_bytes(Conn *conn, const char *data, size_t len) {
+    mock_reserve(conn, len);
+    memcpy(conn->out + conn->out_len, data, len);
+    conn->out_len += len;
+}
+
+static void mock_str(Conn *conn, const char *str) {
+    mock_bytes(conn, str, strlen(str) + 1);
+}
+
+static size_t mock_begin(Conn *conn, char type) {
+    size_t pos;
+    mock_byte(conn, type);
+    pos = conn->out_len;
+    mock_int32(conn, 0);
+    return pos;
+}
+
+static void mock_end(Conn *conn, size_t pos) {
+    uint32_t len = htonl(conn->out_len - pos);
+    memcpy(conn->out + pos, &len, sizeof(len));
+}
+
+static void mock_parameter(Conn *conn, const char *name, const char *value) {
+    size_t pos = mock_begin(conn, 'S');
+    mock_str(conn, name);
+    mock_str(conn, value);
+    mock_end(conn, pos);
+}
+
+static void mock_ready(Conn *conn) {
+    size_t pos = mock_begin(conn, 'Z');
+    mock_byte(conn, 'I');
+    mock_end(conn, pos);
+}
+
+static void mock_complete(Conn *conn, const char *tag) {
+    size_t pos = mock_begin(conn, 'C');
+    mock_str(conn, tag);
+    mock_end(conn, pos);
+}
+
+static void mock_row_description(Conn *conn, const char **names, int count) {
+    size_t pos = mock_begin(conn, 'T');
+    mock_int16(conn, count);
+    for (int i = 0; i < count; i++) {
+        mock_str(conn, names[i]);
+        mock_int32(conn, 0);
+        mock_int16(conn, 0);
+        mock_int32(conn, 25);
+        mock_int16(conn, -1);
+        mock_int32(conn, -1);
+        mock_int16(conn, 0);
+    }
+    mock_end(conn, pos);
+}
+
+static void mock_data_row(Conn *conn, const char **values, int count) {
+    size_t pos = mock_begin(conn, 'D');
+    mock_int16(conn, count);
+    for (int i = 0; i < count; i++) {
+        if (!values[i]) { mock_int32(conn, -1); continue; }
+        mock_int32(conn, strlen(values[i]));
+        mock_bytes(conn, values[i], strlen(values[i]));
+    }
+    mock_end(conn, pos);
+}
+
+static const char *mock_probe_names[] = {"system_identifier", "timeline_id", "history", "lag", "application_name", "state", "sync_state"};
+
+static void mock_probe(Conn *conn, bool describe) {
+    char tag[32];
+    int rows = 0;
+    if (describe) mock_row_description(conn, mock_probe_names, 7);
+    for (int i = 0; i < mock_npeers; i++) {
+        const char *values[] = {mock_system_identifier, mock_timeline_id, NULL, "0", mock_peers[i].host, "streaming", mock_peers[i].state};
+        if (mock_peers[i].state[0] == '\0') continue;
+        mock_data_row(conn, values, 7);
+        rows++;
+    }
+    if (!rows) {
+        const char *values[] = {mock_system_identifier, mock_timeline_id, NULL, NULL, NULL, NULL, NULL};
+        mock_data_row(conn, values, 7);
+        rows++;
+    }
+    snprintf(tag, sizeof(tag), "SELECT %i", rows);
+    mock_complete(conn, tag);
+}
+
+static unsigned mock_classify(const char *sql) {
+    if (strstr(sql, "pg_stat_replication")) return query_probe;
+    if (strstr(sql, "LISTEN")) return query_listen;
+    if (strstr(sql, "transaction_read_only")) return query_read_only;
+    if (!strcmp(sql, "SELECT 1")) return query_ping;
+    return query_other;
+}
+
+static const char *mock_ping_names[] = {"?column?"};
+static const char *mock_read_only_names[] = {"transaction_read_only"};
+
+static void mock_describe(Conn *conn) {
+    switch (conn->query) {
+        case query_probe: mock_row_description(conn, mock_probe_names, 7); break;
+        case query_read_only: mock_row_description(conn, mock_read_only_names, 1); break;
+        case query_ping: mock_row_description(conn, mock_ping_names, 1); break;
+        default: mock_byte(conn, 'n'); mock_int32(conn, 4); break;
+    }
+}
+
+static void mock_execute(Conn *conn, unsigned query, bool describe) {
+    static const char *ping_values[] = {"1"};
+    static const char *read_only_values[] = {"off"};
+    switch (query) {
+        case query_probe: mock_probe(conn, describe); break;
+        case query_listen: mock_complete(conn, "LISTEN"); break;
+        case query_read_only: if (describe) mock_row_description(conn, mock_read_only_names, 1); mock_data_row(conn, read_only_values, 1); mock_complete(conn, "SHOW"); break;
+        case query_ping: if (describe) mock_row_description(conn, mock_ping_names, 1); mock_data_row(conn, ping_values, 1); mock_complete(conn, "SELECT 1"); break;
+        default: mock_complete(conn, "SELECT 0"); break;
+    }
+}
+
+static void mock_close(int i) {
+    close(mock_conns[i].fd);
+    free(mock_conns[i].in);
+    free(mock_conns[i].out);
+    mock_conns[i] = mock_conns[--mock_nconns];
+}
+
+static void mock_schedule(Conn *conn) {
+    conn->ready = mock_now() + mock_delay + (mock_jitter ? rand() % (mock_jitter + 1) : 0);
+}
+
+static bool mock_startup(Conn *conn) {
+    uint32_t len, code;
+    size_t pos;
+    if (conn->in_len < 8) return false;
+    memcpy(&len, conn->in, 4);
+    memcpy(&code, conn->in + 4, 4);
+    len = ntohl(len);
+    code = ntohl(code);
+    if (conn->in_len < len) return false;
+    memmove(conn->in, conn->in + len, conn->in_len - len);
+    conn->in_len -= len;
+    if (code == 80877103 || code == 80877104) { mock_byte(conn, 'N'); return true; }
+    conn->startup = true;
+    pos = mock_begin(conn, 'R');
+    mock_int32(conn, 0);
+    mock_end(conn, pos);
+    mock_parameter(conn, "server_version", "16.0");
+    mock_parameter(conn, "server_encoding", "UTF8");
+    mock_parameter(conn, "client_encoding", "UTF8");
+    mock_parameter(conn, "standard_conforming_strings", "on");
+    mock_parameter(conn, "integer_datetimes", "on");
+    mock_parameter(conn, "default_transaction_read_only", "off");
+    mock_parameter(conn, "in_hot_standby", "off");
+    pos = mock_begin(conn, 'K');
+    mock_int32(conn, getpid());
+    mock_int32(conn, 0);
+    mock_end(conn, pos);
+    mock_ready(conn);
+    return true;
+}
+
+static bool mock_message(Conn *conn) {
+    char type;
+    uint32_t len;
+    char *body;
+    if (conn->in_len < 5) return false;
+    type = conn->in[0];
+    memcpy(&len, conn->in + 1, 4);
+    len = ntohl(len);
+    if (conn->in_len < 1 + len) return false;
+    body = conn->in + 5;
+    switch (type) {
+        case 'Q': { unsigned query = mock_classify(body); mock_execute(conn, query, true); mock_ready(conn); } break;
+        case 'P': conn->query = mock_classify(body + strlen(body) + 1); mock_byte(conn, '1'); mock_int32(conn, 4); break;
+        case 'B': mock_byte(conn, '2'); mock_int32(conn, 4); break;
+        case 'D': mock_describe(conn); break;
+        case 'E': mock_execute(conn, conn->query, false); break;
+        case 'S': mock_ready(conn); break;
+        case 'X': return false;
+        default: break;
+    }
+    memmove(conn->in, conn->in + 1 + len, conn->in_len - 1 - len);
+    conn->in_len -= 1 + len;
+    return true;
+}
+
+static bool mock_read(Conn *conn) {
+    ssize_t n;
+    if (conn->in_size - conn->in_len < 8192) {
+        conn->in_size = conn->in_size * 2 + 8192;
+        if (!(conn->in = realloc(conn->in, conn->in_size))) { perror("realloc"); exit(1); }
+    }
+    if ((n = read(conn->fd, conn->in + conn->in_len, conn->in_size - conn->in_len)) <= 0) return false;
+    conn->in_len += n;
+    if (conn->in_len >= 5 && conn->in[0] == 'X') return false;
+    if (!conn->startup) while (!conn->startup && mock_startup(conn));
+    if (conn->startup) while (mock_message(conn));
+    if (mock_drop && rand() % 100 < mock_drop) return false;
+    if (conn->out_len > conn->out_sent) mock_schedule(conn);
+    return true;
+}
+
+static bool mock_write(Conn *conn) {
+    ssize_t n;
+    if ((n = write(conn->fd, conn->out + conn->out_sent, conn->out_len - conn->out_sent)) < 0) return errno == EAGAIN;
+    conn->out_sent += n;
+    if (conn->out_sent == conn->out_len) conn->out_sent = conn->out_len = 0;
+    return true;
+}
+
+static void mock_step(void) {
+    long now = mock_now() - mock_start;
+    for (int i = 0; i < mock_nsteps; i++) {
+        Step *step = &mock_steps[i];
+        if (step->done || step->at > now) continue;
+        step->done = true;
+        for (int j = 0; j < mock_npeers; j++) if (!strcmp(mock_peers[j].host, step->host)) { snprintf(mock_peers[j].state, sizeof(mock_peers[j].state), "%s", strcmp(step->state, "-") ? step->state : ""); break; }
+        printf("%ld step %s %s\n", mock_clock(CLOCK_REALTIME), step->host, step->state);
+        fflush(stdout);
+    }
+}
+
+static void mock_script(const char *filename) {
+    char line[256];
+    FILE *file;
+    if (!(file = fopen(filename, "r"))) { perror(filename); exit(1); }
+    while (fgets(line, sizeof(line), file)) {
+        Step step = {0};
+        if (line[0] == '#' || sscanf(line, "%ld %63s %15s", &step.at, step.host, step.state) != 3) continue;
+        if (!(mock_steps = realloc(mock_steps, (mock_nsteps + 1) * sizeof(*mock_steps)))) { perror("realloc"); exit(1); }
+        mock_steps[mock_nsteps++] = step;
+    }
+    fclose(file);
+}
+
+static int mock_listen(const char *host, int port) {
+    int fd;
+    int on = 1;
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) { fprintf(stderr, "invalid address %s\n", host); exit(1); }
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) { perror("socket"); exit(1); }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) { perror(host); exit(1); }
+    if (listen(fd, 128) == -1) { perror("listen"); exit(1); }
+    return fd;
+}
+
+static void mock_usage(const char *progname) {
+    fprintf(stderr, "usage: %s --port=PORT --peers=N [--system-identifier=ID] [--timeline=TLI] [--delay=MS] [--jitter=MS] [--drop=PERCENT] [--script=FILE]\n", progname);
+    fprintf(stderr, "listens on 127.1.0.1 (primary) and 127.1.X.Y for N peers; the first peer is sync, the rest async\n");
+    fprintf(stderr, "script lines are \"MS HOST STATE\", STATE \"-\" removes HOST from pg_stat_replication\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    static struct option options[] = {
+        {"delay", required_argument, NULL, 'd'},
+        {"drop", required_argument, NULL, 'x'},
+        {"jitter", required_argument, NULL, 'j'},
+        {"peers", required_argument, NULL, 'n'},
+        {"port", required_argument, NULL, 'p'},
+        {"script", required_argument, NULL, 's'},
+        {"system-identifier", required_argument, NULL, 'i'},
+        {"timeline", required_argument, NULL, 't'},
+        {NULL, 0, NULL, 0}
+    };
+    int c;
+    int nlisten;
+    int port = 0;
+    int *listeners;
+    struct pollfd *fds;
+    while ((c = getopt_long(argc, argv, "d:x:j:n:p:s:i:t:", options, NULL)) != -1) switch (c) {
+        case 'd': mock_delay = atoi(optarg); break;
+        case 'x': mock_drop = atoi(optarg); break;
+        case 'j': mock_jitter = atoi(optarg); break;
+        case 'n': mock_npeers = atoi(optarg); break;
+        case 'p': port = atoi(optarg); break;
+        case 's': mock_script(optarg); break;
+        case 'i': mock_system_identifier = optarg; break;
+        case 't': mock_timeline_id = optarg; break;
+        default: mock_usage(argv[0]);
+    }
+    if (!port || mock_npeers < 0 || mock_npeers > MOCK_MAX_PEER) mock_usage(argv[0]);
+    nlisten = mock_npeers + 1;
+    if (!(listeners = calloc(nlisten, sizeof(*listeners))) || !(fds = calloc(nlisten + MOCK_MAX_CONN, sizeof(*fds)))) { perror("calloc"); exit(1); }
+    listeners[0] = mock_listen("127.1.0.1", port);
+    for (int i = 0; i < mock_npeers; i++) {
+        snprintf(mock_peers[i].host, sizeof(mock_peers[i].host), "127.1.%i.%i", (i + 2) / 250, (i + 2) % 250 + 1);
+        snprintf(mock_peers[i].state, sizeof(mock_peers[i].state), "%s", i ? "async" : "sync");
+        listeners[i + 1] = mock_listen(mock_peers[i].host, port);
+    }
+    srand(getpid());
+    mock_start = mock_now();
+    printf("%ld listen %i peers on port %i\n", mock_clock(CLOCK_REALTIME), mock_npeers, port);
+    fflush(stdout);
+    for (;;) {
+        int nfds = 0;
+        int timeout = 100;
+        long now = mock_now();
+        for (int i = 0; i < nlisten; i++) { fds[nfds].fd = listeners[i]; fds[nfds].events = mock_nconns < MOCK_MAX_CONN ? POLLIN : 0; nfds++; }
+        for (int i = 0; i < mock_nconns; i++) {
+            Conn *conn = &mock_conns[i];
+            fds[nfds].fd = conn->fd;
+            fds[nfds].events = POLLIN;
+            if (conn->out_len > conn->out_sent) {
+                if (conn->ready <= now) fds[nfds].events |= POLLOUT;
+                else if (conn->ready - now < timeout) timeout = conn->ready - now;
+            }
+            nfds++;
+        }
+        if (poll(fds, nfds, timeout) == -1 && errno != EINTR) { perror("poll"); exit(1); }
+        mock_step();
+        for (int i = 0; i < nlisten; i++) if (fds[i].revents & POLLIN) {
+            int fd = accept(listeners[i], NULL, NULL);
+            if (fd == -1) continue;
+            memset(&mock_conns[mock_nconns], 0, sizeof(mock_conns[mock_nconns]));
+            mock_conns[mock_nconns++].fd = fd;
+        }
+        for (int i = nfds - nlisten - 1; i >= 0; i--) {
+            short revents = fds[nlisten + i].revents;
+            if (i >= mock_nconns) continue;
+            if ((revents & (POLLERR | POLLHUP)) || ((revents & POLLIN) && !mock_read(&mock_conns[i])) || ((revents & POLLOUT) && !mock_write(&mock_conns[i]))) mock_close(i);
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#!/bin/sh -eu
+
+PEERS="${PEERS:-100}"
+PORT="${PORT:-55432}"
+DURATION="${DURATION:-60}"
+DELAY="${DELAY:-0}"
+JITTER="${JITTER:-0}"
+DROP="${DROP:-0}"
+BENCH="$(mktemp -d)"
+trap 'pg_ctl --pgdata="$BENCH/data" --mode=immediate stop >/dev/null 2>&1 || true; kill "$MOCK" 2>/dev/null || true; rm -rf "$BENCH"' EXIT
+cd "$(dirname "$0")"
+initdb --pgdata="$BENCH/data" --username=postgres >/dev/null
+SYSTEM_IDENTIFIER="$(pg_controldata "$BENCH/data" | sed -n 's/^Database system identifier: *//p')"
+cat >>"$BENCH/data/postgresql.conf" <<CONF
+listen_addresses = '127.0.0.1'
+port = $((PORT + 1))
+unix_socket_directories = '$BENCH'
+shared_preload_libraries = 'pg_save'
+hot_standby = on
+pg_save.timeout = ${TIMEOUT:-1000}
+CONF
+printf "state = 'async'\nprimary = '127.1.0.1'\n" >"$BENCH/data/pg_save.conf"
+touch "$BENCH/data/standby.signal"
+{
+    echo "# at_ms host state"
+    echo "$((DURATION * 500)) 127.1.0.3 -"
+    echo "$((DURATION * 500)) 127.1.0.4 sync"
+} >"$BENCH/script"
+./pg_save_mock --port="$PORT" --peers="$PEERS" --system-identifier="$SYSTEM_IDENTIFIER" --delay="$DELAY" --jitter="$JITTER" --drop="$DROP" --script="$BENCH/script" >"$BENCH/mock.log" &
+MOCK=$!
+HOSTNAME=bench PGPORT="$PORT" pg_ctl --pgdata="$BENCH/data" --log="$BENCH/postgres.log" --wait start >/dev/null
+WORKER=""
+for _ in $(seq 1 100); do WORKER="$(pgrep -f "pg_save bench\$" || true)"; test -n "$WORKER" && break; sleep 0.1; done
+test -n "$WORKER" || { echo "worker did not start"; cat "$BENCH/postgres.log"; exit 1; }
+TICKS="$(getconf CLK_TCK)"
+cpu() { awk '{print $14 + $15}' "/proc/$WORKER/stat"; }
+switches() { awk '/ctxt_switches/ {n += $2} END {print n}' "/proc/$WORKER/status"; }
+CPU0="$(cpu)"
+CTX0="$(switches)"
+DECIDED=""
+END=$(($(date +%s) + DURATION))
+while test "$(date +%s)" -lt "$END"; do
+    if test -z "$DECIDED"; then
+        grep -q "step" "$BENCH/mock.log" && grep -q "^sync = '127.1.0.4'" "$BENCH/data/pg_save.conf" && DECIDED="$(date +%s%3N)"
+    fi
+    sleep 0.01
+done
+CPU1="$(cpu)"
+CTX1="$(switches)"
+STEP="$(awk '$2 == "step" {print $1; exit}' "$BENCH/mock.log")"
+echo "peers = $PEERS, delay = $DELAY ms, jitter = $JITTER ms, drop = $DROP %"
+echo "worker cpu = $(echo "scale=2; 100 * ($CPU1 - $CPU0) / $TICKS / $DURATION" | bc) %"
+echo "worker wakeups = $(echo "scale=2; ($CTX1 - $CTX0) / $DURATION" | bc) /s"
+if test -n "$DECIDED" -a -n "$STEP"; then echo "decision latency = $((DECIDED - STEP)) ms"; else echo "decision latency = none"; fi
@@ -0,0 +1,262 @@
+#include "bin.h"
+
+static char archive_catalog[MAXPGPATH];
+static const char *archive_dir;
+
+static bool archive_crc(const char *filename, pg_crc32c *crc, uint64 *size) {
+    char buf[BLCKSZ];
+    FILE *file;
+    size_t len;
+    if (!(file = fopen(filename, "r"))) { pg_log_warning("fopen(\"%s\") and %m", filename); return false; }
+    INIT_CRC32C(*crc);
+    *size = 0;
+    while ((len = fread(buf, 1, sizeof(buf), file)) > 0) { COMP_CRC32C(*crc, buf, len); *size += len; }
+    if (ferror(file)) { pg_log_warning("fread(\"%s\") and %m", filename); fclose(file); return false; }
+    fclose(file);
+    FIN_CRC32C(*crc);
+    return true;
+}
+
+static int archive_open(int flags, int operation) {
+    for (;;) {
+        int fd;
+        struct stat fsb, sb;
+        if ((fd = open(archive_catalog, flags | PG_BINARY, pg_file_create_mode)) == -1) { pg_log_warning("open(\"%s\") and %m", archive_catalog); return -1; }
+        if (flock(fd, operation) == -1) { pg_log_warning("flock(\"%s\") and %m", archive_catalog); close(fd); return -1; }
+        if (fstat(fd, &fsb) == -1 || stat(archive_catalog, &sb) == -1) { pg_log_warning("stat(\"%s\") and %m", archive_catalog); close(fd); return -1; }
+        if (fsb.st_ino == sb.st_ino && fsb.st_dev == sb.st_dev) return fd;
+        close(fd);
+    }
+}
+
+static bool archive_fsync(const char *filename) {
+    int fd;
+    if ((fd = open(filename, O_RDONLY | PG_BINARY, 0)) == -1) { pg_log_warning("open(\"%s\") and %m", filename); return false; }
+    if (fsync(fd)) { pg_log_warning("fsync(\"%s\") and %m", filename); close(fd); return false; }
+    close(fd);
+    return true;
+}
+
+static bool archive_rename(const char *tmp, const char *filename) {
+    if (!archive_fsync(tmp)) return false;
+    if (rename(tmp, filename)) { pg_log_warning("rename(\"%s\", \"%s\") and %m", tmp, filename); return false; }
+    return archive_fsync(archive_dir);
+}
+
+static int archive_read_fd(int fd, ArchiveRecord **records) {
+    int count;
+    struct stat sb;
+    *records = NULL;
+    if (fstat(fd, &sb) == -1) { pg_log_warning("fstat(\"%s\") and %m", archive_catalog); return -1; }
+    if (!(count = sb.st_size / sizeof(**records))) return 0;
+    if (!(*records = malloc(count * sizeof(**records)))) { pg_log_warning("malloc and %m"); return -1; }
+    if (pread(fd, *records, count * sizeof(**records), 0) != count * sizeof(**records)) { pg_log_warning("pread(\"%s\") and %m", archive_catalog); free(*records); *records = NULL; return -1; }
+    return count;
+}
+
+static int archive_read(ArchiveRecord **records) {
+    int count;
+    int fd;
+    *records = NULL;
+    if ((fd = archive_open(O_RDONLY | O_CREAT, LOCK_SH)) == -1) return -1;
+    count = archive_read_fd(fd, records);
+    close(fd);
+    return count;
+}
+
+static bool archive_find(const char *name, ArchiveRecord *record) {
+    ArchiveRecord *records;
+    char filename[MAXPGPATH];
+    int count;
+    int fd;
+    struct stat sb;
+    snprintf(filename, sizeof(filename), "%s/%s.rec", archive_dir, name);
+    if ((fd = open(filename, O_RDONLY | PG_BINARY, 0)) != -1) {
+        bool ok = read(fd, record, sizeof(*record)) == sizeof(*record) && !strncmp(record->name, name, sizeof(record->name));
+        close(fd);
+        if (ok) return true;
+    }
+    snprintf(filename, sizeof(filename), "%s/%s.gz", archive_dir, name);
+    if (stat(filename, &sb) || !S_ISREG(sb.st_mode)) return false;
+    if ((count = archive_read(&records)) <= 0) return false;
+    for (int i = count - 1; i >= 0; i--) if (!strcmp(records[i].name, name)) { *record = records[i]; free(records); return true; }
+    free(records);
+    return false;
+}
+
+static bool archive_prunable(const char *name, const char *oldest) {
+    size_t hex = strspn(name, "0123456789ABCDEF");
+    uint32 oldest_tli;
+    uint32 tli;
+    if (hex == 8 && !strcmp(name + hex, ".history")) return sscanf(name, "%08X", &tli) == 1 && sscanf(oldest, "%08X", &oldest_tli) == 1 && tli < oldest_tli;
+    if (hex != XLOG_FNAME_LEN || (name[hex] != '\0' && name[hex] != '.')) return false;
+    return strncmp(name + 8, oldest + 8, XLOG_FNAME_LEN - 8) < 0;
+}
+
+static bool archive_record(const ArchiveRecord *record) {
+    char filename[MAXPGPATH];
+    char tmp[MAXPGPATH];
+    FILE *file;
+    snprintf(filename, sizeof(filename), "%s/%s.rec", archive_dir, record->name);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+    if (!(file = fopen(tmp, "w"))) { pg_log_error("fopen(\"%s\") and %m", tmp); return false; }
+    if (fwrite(record, sizeof(*record), 1, file) != 1) { pg_log_error("fwrite(\"%s\") and %m", tmp); fclose(file); unlink(tmp); return false; }
+    fclose(file);
+    if (!archive_rename(tmp, filename)) { unlink(tmp); return false; }
+    return true;
+}
+
+static void archive_init(const char *dir) {
+    archive_dir = dir;
+    snprintf(archive_catalog, sizeof(archive_catalog), "%s/%s", archive_dir, "catalog");
+}
+
+int archive_archive(const char *dir, const char *path, const char *name, bool archiver) {
+    ArchiveRecord record = {0};
+    char filename[MAXPGPATH];
+    char str[3 * MAXPGPATH];
+    char tmp[MAXPGPATH];
+    int fd;
+    struct stat sb;
+    archive_init(dir);
+    if (strlen(name) >= sizeof(record.name)) { pg_log_error("name \"%s\" is too long", name); return 1; }
+    snprintf(filename, sizeof(filename), "%s/%s.gz", archive_dir, name);
+    if (archive_find(name, &record) && !stat(filename, &sb) && S_ISREG(sb.st_mode)) { pg_log_info("\"%s\" is already archived", filename); return 0; }
+    if (!archiver) { pg_log_info("\"%s\" is left to archiver", name); return 1; }
+    MemSet(&record, 0, sizeof(record));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+    snprintf(str, sizeof(str), CMD(gzip -c "%s" >"%s"), path, tmp);
+    if (system(str)) { pg_log_error("system(\"%s\") and %m", str); unlink(tmp); return 1; }
+    if (!archive_crc(tmp, &record.crc, &record.size) || !archive_rename(tmp, filename)) { unlink(tmp); return 1; }
+    strlcpy(record.name, name, sizeof(record.name));
+    if (strspn(name, "0123456789ABCDEF") >= 8) sscanf(name, "%08X", &record.timeline);
+    record.time = time(NULL);
+    if (!archive_record(&record)) return 1;
+    if ((fd = archive_open(O_WRONLY | O_CREAT | O_APPEND, LOCK_EX)) == -1) return 1;
+    if (write(fd, &record, sizeof(record)) != sizeof(record)) { pg_log_error("write(\"%s\") and %m", archive_catalog); close(fd); return 1; }
+    if (fsync(fd)) { pg_log_error("fsync(\"%s\") and %m", archive_catalog); close(fd); return 1; }
+    close(fd);
+    return 0;
+}
+
+int archive_restore(const char *dir, const char *name, const char *path) {
+    ArchiveRecord record;
+    char filename[MAXPGPATH];
+    char str[3 * MAXPGPATH];
+    pg_crc32c crc;
+    struct stat sb;
+    uint64 size;
+    archive_init(dir);
+    snprintf(filename, sizeof(filename), "%s/%s.gz", archive_dir, name);
+    if (!archive_find(name, &record)) {
+        if (stat(filename, &sb) || !S_ISREG(sb.st_mode)) return 1;
+        pg_log_warning("\"%s\" is not in catalog", filename);
+    } else {
+        if (!archive_crc(filename, &crc, &size)) { pg_log_error("\"%s\" is in catalog but missing", filename); return 1; }
+        if (size != record.size || !EQ_CRC32C(crc, record.crc)) { pg_log_error("\"%s\" is corrupt: size %lu != %lu or crc %08X != %08X", filename, (unsigned long)size, (unsigned long)record.size, crc, record.crc); return 1; }
+    }
+    snprintf(str, sizeof(str), CMD(gunzip -c "%s" >"%s"), filename, path);
+    if (system(str)) { pg_log_error("system(\"%s\") and %m", str); return 1; }
+    return 0;
+}
+
+static bool archive_oldest(char *oldest) {
+    char base[MAXPGPATH];
+    char filename[MAXPGPATH];
+    char line[MAXPGPATH];
+    char name[MAXPGPATH] = "";
+    DIR *dir;
+    FILE *file;
+    struct dirent *de;
+    snprintf(base, sizeof(base), "%s/base", archive_dir);
+    if (!(dir = opendir(base))) return false;
+    while ((de = readdir(dir))) {
+        if (de->d_name[0] == '.' || strchr(de->d_name, '.')) continue;
+        if (name[0] == '\0' || strcmp(de->d_name, name) < 0) strlcpy(name, de->d_name, sizeof(name));
+    }
+    closedir(dir);
+    if (name[0] == '\0') return false;
+    snprintf(filename, sizeof(filename), "%s/%s/backup_label", base, name);
+    if (!(file = fopen(filename, "r"))) { pg_log_warning("fopen(\"%s\") and %m", filename); return false; }
+    oldest[0] = '\0';
+    while (fgets(line, sizeof(line), file)) if (sscanf(line, "START WAL LOCATION: %*X/%*X (file %24s)", oldest) == 1) break;
+    fclose(file);
+    return oldest[0] != '\0';
+}
+
+int archive_prune(const char *dir) {
+    ArchiveRecord *records;
+    char filename[MAXPGPATH];
+    char oldest[MAXPGPATH];
+    char tmp[MAXPGPATH];
+    int count;
+    int fd;
+    int kept = 0;
+    int removed = 0;
+    archive_init(dir);
+    if (!archive_oldest(oldest)) { pg_log_info("no base backup, nothing to prune"); return 0; }
+    pg_log_info("prune segments before %s", oldest);
+    if ((fd = archive_open(O_RDWR | O_CREAT, LOCK_EX)) == -1) return 1;
+    if ((count = archive_read_fd(fd, &records)) < 0) { close(fd); return 1; }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", archive_catalog);
+    for (int i = 0; i < count; i++) {
+        if (archive_prunable(records[i].name, oldest)) {
+            snprintf(filename, sizeof(filename), "%s/%s.gz", archive_dir, records[i].name);
+            if (unlink(filename) && errno != ENOENT) { pg_log_warning("unlink(\"%s\") and %m", filename); records[kept++] = records[i]; continue; }
+            snprintf(filename, sizeof(filename), "%s/%s.rec", archive_dir, records[i].name);
+            if (unlink(filename) && errno != ENOENT) pg_log_warning("unlink(\"%s\") and %m", filename);
+            removed++;
+        } else records[kept++] = records[i];
+    }
+    if (removed) {
+        FILE *file;
+        if (!(file = fopen(tmp, "w"))) { pg_log_error("fopen(\"%s\") and %m", tmp); free(records); close(fd); return 1; }
+        if (kept && fwrite(records, sizeof(*records), kept, file) != kept) { pg_log_error("fwrite != %i and %m", kept); fclose(file); free(records); close(fd); return 1; }
+        fclose(file);
+        if (!archive_rename(tmp, archive_catalog)) { free(records); close(fd); return 1; }
+    }
+    pg_log_info("removed = %i, kept = %i", removed, kept);
+    if (records) free(records);
+    close(fd);
+    return 0;
+}
+
+int archive_verify(const char *dir) {
+    ArchiveRecord *records;
+    int corrupt = 0;
+    int count;
+    int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    pid_t *pids;
+    archive_init(dir);
+    if ((count = archive_read(&records)) <= 0) return count < 0;
+    jobs = Max(Min(jobs, count), 1);
+    if (!(pids = malloc(jobs * sizeof(*pids)))) { pg_log_error("malloc and %m"); free(records); return 1; }
+    for (int job = 0; job < jobs; job++) switch ((pids[job] = fork())) {
+        case -1: pg_log_error("fork and %m"); pids[job] = 0; corrupt++; break;
+        case 0: {
+            int bad = 0;
+            for (int i = job; i < count; i += jobs) {
+                char filename[MAXPGPATH];
+                pg_crc32c crc;
+                uint64 size;
+                snprintf(filename, sizeof(filename), "%s/%s.gz", archive_dir, records[i].name);
+                if (!archive_crc(filename, &crc, &size)) { bad++; continue; }
+                if (size == records[i].size && EQ_CRC32C(crc, records[i].crc)) continue;
+                pg_log_error("\"%s\" is corrupt: size %lu != %lu or crc %08X != %08X", filename, (unsigned long)size, (unsigned long)records[i].size, crc, records[i].crc);
+                bad++;
+            }
+            exit(Min(bad, 255));
+        }
+        default: break;
+    }
+    for (int job = 0; job < jobs; job++) {
+        int status;
+        if (!pids[job]) continue;
+        if (waitpid(pids[job], &status, 0) == -1) { pg_log_error("waitpid and %m"); corrupt++; continue; }
+        corrupt += WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+    }
+    pg_log_info("verified = %i, corrupt = %i", count, corrupt);
+    free(pids);
+    free(records);
+    return corrupt ? 1 : 0;
+}
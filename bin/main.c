@@ -1,15 +1,24 @@
 #include "bin.h"
 
+static char arclog_dir[MAXPGPATH];
 static char pg_hba_conf[MAXPGPATH];
+static char pg_save_conf[MAXPGPATH];
+static char pg_save_profile_conf[MAXPGPATH];
+static char pg_save_resync[MAXPGPATH];
 static char postgresql_auto_conf[MAXPGPATH];
+static char postgresql_conf[MAXPGPATH];
 static char standby_signal[MAXPGPATH];
 static const char *arclog;
+static const char *archiver;
 static const char *cluster_name;
 static const char *hostname;
 static const char *pgdata;
 static const char *primary;
 static const char *primary_conninfo;
+static const char *profile;
 static const char *progname;
+static const char *source;
+static const char *storage;
 
 static void main_recovery(void) {
     FILE *file;
@@ -24,52 +33,215 @@ static void main_recovery(void) {
     fclose(file);
 }
 
+static int main_load(const char *host) {
+    char conninfo[MAXPGPATH];
+    int load = -1;
+    PGconn *conn;
+    PGresult *result;
+    snprintf(conninfo, sizeof(conninfo), "host=%s application_name=%s connect_timeout=5", host, hostname);
+    if (!(conn = PQconnectdb(conninfo)) || PQstatus(conn) != CONNECTION_OK) { pg_log_warning("%s: !PQconnectdb and %s", host, PQerrorMessageMy(conn)); if (conn) PQfinish(conn); return -1; }
+    if (!(result = PQexec(conn, "SELECT count(*) AS load FROM pg_stat_activity WHERE state = 'active' AND pid <> pg_backend_pid() HAVING pg_is_in_recovery()"))) { pg_log_warning("%s: !PQexec and %s", host, PQerrorMessageMy(conn)); PQfinish(conn); return -1; }
+    if (PQresultStatus(result) == PGRES_TUPLES_OK && PQntuples(result) == 1) load = atoi(PQgetvalue(result, 0, PQfnumber(result, "load")));
+    else pg_log_warning("%s: PQresultStatus = %s and %s", host, PQresStatus(PQresultStatus(result)), PQresultErrorMessageMy(result));
+    PQclear(result);
+    PQfinish(conn);
+    return load;
+}
+
+static const char *main_source(void) {
+    char lag[MAXINT8LEN + 1];
+    const char *env = getenv("SOURCE_LAG");
+    const char *values[] = {lag, hostname};
+    int best = INT_MAX;
+    PGconn *conn;
+    PGresult *result;
+    static char best_source[MAXPGPATH];
+    if (!primary) return NULL;
+    snprintf(lag, sizeof(lag), "%s", env ? env : "16777216");
+    if (!(conn = PQconnectdb(primary_conninfo)) || PQstatus(conn) != CONNECTION_OK) { pg_log_warning("!PQconnectdb and %s", PQerrorMessageMy(conn)); if (conn) PQfinish(conn); return primary; }
+    if (!(result = PQexecParams(conn, "SELECT application_name FROM pg_stat_replication WHERE state = 'streaming' AND application_name <> $2 AND pg_wal_lsn_diff(pg_current_wal_lsn(), replay_lsn) <= $1::bigint ORDER BY pg_wal_lsn_diff(pg_current_wal_lsn(), replay_lsn)", countof(values), NULL, values, NULL, NULL, false))) { pg_log_warning("!PQexecParams and %s", PQerrorMessageMy(conn)); PQfinish(conn); return primary; }
+    if (PQresultStatus(result) != PGRES_TUPLES_OK) { pg_log_warning("PQresultStatus = %s and %s", PQresStatus(PQresultStatus(result)), PQresultErrorMessageMy(result)); PQclear(result); PQfinish(conn); return primary; }
+    for (int row = 0; row < PQntuples(result); row++) {
+        const char *host = PQgetvalue(result, row, PQfnumber(result, "application_name"));
+        int load = main_load(host);
+        pg_log_info("%s: load = %i", host, load);
+        if (load < 0 || load >= best) continue;
+        best = load;
+        strlcpy(best_source, host, sizeof(best_source));
+    }
+    PQclear(result);
+    PQfinish(conn);
+    pg_log_info("source = %s", best < INT_MAX ? best_source : primary);
+    return best < INT_MAX ? best_source : primary;
+}
+
+static void main_local_move(const char *from, const char *to) {
+    static const char *files[] = {"pg_save.conf", "pg_save.history", "pg_save.journal"};
+    for (int i = 0; i < countof(files); i++) {
+        char src[MAXPGPATH];
+        char dst[MAXPGPATH];
+        snprintf(src, sizeof(src), "%s/%s", from, files[i]);
+        snprintf(dst, sizeof(dst), "%s/%s", to, files[i]);
+        if (unlink(dst) && errno != ENOENT) pg_log_warning("unlink(\"%s\") and %m", dst);
+        if (rename(src, dst) && errno != ENOENT) pg_log_warning("rename(\"%s\", \"%s\") and %m", src, dst);
+    }
+}
+
+static bool main_restore(const char *tmp) {
+    char base[MAXPGPATH];
+    char newest[MAXPGPATH] = "";
+    char str[4 * MAXPGPATH];
+    DIR *dir;
+    struct dirent *de;
+    struct stat sb;
+    if (!arclog) return false;
+    snprintf(base, sizeof(base), "%s/base", arclog_dir);
+    if (!(dir = opendir(base))) return false;
+    while ((de = readdir(dir))) {
+        if (de->d_name[0] == '.' || strchr(de->d_name, '.')) continue;
+        if (strcmp(de->d_name, newest) > 0) strlcpy(newest, de->d_name, sizeof(newest));
+    }
+    closedir(dir);
+    if (newest[0] == '\0') return false;
+    snprintf(str, sizeof(str), CMD(tar --extract --gzip --file="%s/%s/base.tar.gz" --directory="%s" && cp "%s/%s/backup_label" "%s/backup_label"), base, newest, tmp, base, newest, tmp);
+    pg_log_info("%s", str);
+    if (system(str)) { pg_log_warning("system(\"%s\") and %m", str); rmtree(tmp, false); return false; }
+    snprintf(str, sizeof(str), "%s/%s/tablespace_map", base, newest);
+    if (!stat(str, &sb) && S_ISREG(sb.st_mode)) {
+        snprintf(str, sizeof(str), CMD(cp "%s/%s/tablespace_map" "%s/tablespace_map"), base, newest, tmp);
+        pg_log_info("%s", str);
+        if (system(str)) { pg_log_warning("system(\"%s\") and %m", str); rmtree(tmp, false); return false; }
+    }
+    return true;
+}
+
+static void main_arclog_move(const char *tmp) {
+    char dst[MAXPGPATH];
+    char parent[MAXPGPATH];
+    struct stat sb;
+    if (!arclog || is_absolute_path(arclog)) return;
+    snprintf(dst, sizeof(dst), "%s/%s", tmp, arclog);
+    if (!stat(dst, &sb) && S_ISDIR(sb.st_mode)) rmtree(dst, true);
+    strlcpy(parent, dst, sizeof(parent));
+    get_parent_directory(parent);
+    if (pg_mkdir_p(parent, pg_dir_create_mode) == -1) pg_log_error("pg_mkdir_p(\"%s\") == -1 and %m", parent);
+    if (rename(arclog_dir, dst) && errno != ENOENT) pg_log_error("rename(\"%s\", \"%s\") and %m", arclog_dir, dst);
+}
+
 static void main_backup(void) {
     char tmp[] = "XXXXXX";
     char str[MAXPGPATH];
-    snprintf(str, sizeof(str), CMD(
-        pg_basebackup
-            --dbname="host=%s application_name=%s target_session_attrs=read-write"
-            --pgdata="%s"
-            --progress
-            --verbose
-            --wal-method=stream
-    ), primary, hostname, mktemp(tmp));
-    if (pg_mkdir_p(tmp, pg_dir_create_mode) == -1) pg_log_error("pg_mkdir_p(\"%s\") == -1 and %m", tmp);
-    pg_log_info("%s", str);
-    if (system(str)) { rmtree(pgdata, true); pg_log_error("system(\"%s\") and %m", str); }
+    if (pg_mkdir_p(mktemp(tmp), pg_dir_create_mode) == -1) pg_log_error("pg_mkdir_p(\"%s\") == -1 and %m", tmp);
+    if (!main_restore(tmp)) {
+        if (!source) source = main_source();
+        snprintf(str, sizeof(str), CMD(
+            pg_basebackup
+                --dbname="host=%s application_name=%s"
+                --pgdata="%s"
+                --progress
+                --verbose
+                --wal-method=stream
+        ), source, hostname, tmp);
+        pg_log_info("%s", str);
+        if (system(str)) pg_log_error("system(\"%s\") and %m", str);
+    }
+    main_arclog_move(tmp);
+    main_local_move(pgdata, tmp);
     rmtree(pgdata, true);
     if (rename(tmp, pgdata)) pg_log_error("rename(\"%s\", \"%s\") and %m", tmp, pgdata);
 }
 
+static bool main_resync(void) {
+    char conninfo[MAXPGPATH];
+    if (!source) source = main_source();
+    snprintf(conninfo, sizeof(conninfo), "host=%s application_name=%s", source, hostname);
+    return !resync_resync(pgdata, conninfo);
+}
+
 static void main_rewind(void) {
+    bool rewound;
     char str[MAXPGPATH];
+    char tmp[] = "XXXXXX";
+#if PG_VERSION_NUM >= 140000
+    const char *from = source ? source : (source = main_source());
+#else
+    const char *from = primary;
+#endif
     snprintf(str, sizeof(str), CMD(
         pg_rewind
             --progress
             --restore-target-wal
-            --source-server="host=%s application_name=%s target_session_attrs=read-write"
+            --source-server="host=%s application_name=%s"
             --target-pgdata="%s"
-    ), primary, hostname, pgdata);
+    ), from, hostname, pgdata);
     pg_log_info("%s", str);
-    if (system(str)) main_backup();
+    if (pg_mkdir_p(mktemp(tmp), pg_dir_create_mode) == -1) pg_log_error("pg_mkdir_p(\"%s\") == -1 and %m", tmp);
+    main_local_move(pgdata, tmp);
+    rewound = !system(str);
+    main_local_move(tmp, pgdata);
+    rmtree(tmp, true);
+    if (!rewound && !main_resync()) main_backup();
     main_recovery();
 }
 
-static char *main_state(void) {
+static bool main_diverged(void) {
+    bool crc_ok;
+    bool diverged = true;
+    char conninfo[MAXPGPATH];
+    ControlFileData *control;
+    PGconn *conn;
+    PGresult *result;
+    TimeLineID tli;
+    XLogRecPtr checkpoint;
+#if PG_VERSION_NUM >= 120000
+    if (!(control = get_controlfile(pgdata, &crc_ok))) return true;
+#else
+    if (!(control = get_controlfile(pgdata, progname, &crc_ok))) return true;
+#endif
+    if (!crc_ok || control->state != DB_SHUTDOWNED) { pg_log_info("control file is not from a clean shutdown"); pfree(control); return true; }
+    checkpoint = control->checkPoint;
+    tli = control->checkPointCopy.ThisTimeLineID;
+    pfree(control);
+    snprintf(conninfo, sizeof(conninfo), "host=%s application_name=%s", primary, hostname);
+    if (!(conn = PQconnectdb(conninfo)) || PQstatus(conn) != CONNECTION_OK) { pg_log_warning("%s: !PQconnectdb and %s", primary, PQerrorMessageMy(conn)); if (conn) PQfinish(conn); return true; }
+    if (!(result = PQexec(conn, "SELECT coalesce((SELECT pg_read_file('pg_wal/' || name) FROM pg_ls_waldir() WHERE name ~ '^[0-9A-F]{8}[.]history$' ORDER BY name DESC LIMIT 1), '') AS history, pg_current_wal_flush_lsn() AS lsn WHERE NOT pg_is_in_recovery()"))) { pg_log_warning("%s: !PQexec and %s", primary, PQerrorMessageMy(conn)); PQfinish(conn); return true; }
+    if (PQresultStatus(result) == PGRES_TUPLES_OK && PQntuples(result) == 1) {
+        char *history = PQgetvalue(result, 0, PQfnumber(result, "history"));
+        TimeLineID primary_tli = 1;
+        uint32 hi;
+        uint32 lo;
+        XLogRecPtr switchpoint = InvalidXLogRecPtr;
+        for (char *line = history, *next; line && *line; line = next) {
+            TimeLineID parent;
+            if ((next = strchr(line, '\n'))) *next++ = '\0';
+            if (sscanf(line, "%u\t%X/%X", &parent, &hi, &lo) != 3) continue;
+            primary_tli = parent + 1;
+            if (parent == tli) switchpoint = ((uint64)hi << 32) | lo;
+        }
+        if (tli == primary_tli && sscanf(PQgetvalue(result, 0, PQfnumber(result, "lsn")), "%X/%X", &hi, &lo) == 2) switchpoint = ((uint64)hi << 32) | lo;
+        diverged = XLogRecPtrIsInvalid(switchpoint) || checkpoint >= switchpoint;
+        pg_log_info("timeline %u checkpoint %X/%X, primary timeline %u switchpoint %X/%X, %s", tli, (uint32)(checkpoint >> 32), (uint32)checkpoint, primary_tli, (uint32)(switchpoint >> 32), (uint32)switchpoint, diverged ? "diverged" : "not diverged");
+    } else pg_log_warning("%s: PQresultStatus = %s and %s", primary, PQresStatus(PQresultStatus(result)), PQresultErrorMessageMy(result));
+    PQclear(result);
+    PQfinish(conn);
+    return diverged;
+}
+
+static char *main_conf_read(const char *filename, const char *prefix) {
     char *line = NULL;
     FILE *file;
     size_t len = 0;
+    size_t size = strlen(prefix);
     ssize_t read;
-    static char state[MAXPGPATH];
-    if (!(file = fopen(postgresql_auto_conf, "r"))) pg_log_error("fopen(\"%s\") and %m", postgresql_auto_conf);
+    static char value[MAXPGPATH];
+    if (!(file = fopen(filename, "r"))) return NULL;
     while ((read = getline(&line, &len, file)) != -1) {
-        if (read > sizeof("pg_save.state = '") - 1 && !strncmp(line, "pg_save.state = '", sizeof("pg_save.state = '") - 1)) {
-            memcpy(state, line + sizeof("pg_save.state = '") - 1, read - (sizeof("pg_save.state = '") - 1) - 1 - 1);
+        if (read > size && !strncmp(line, prefix, size)) {
+            memcpy(value, line + size, read - size - 1 - 1);
+            value[read - size - 1 - 1] = '\0';
             if (line) free(line);
             fclose(file);
-            pg_log_info("state = %s", state);
-            return state;
+            return value;
         }
     }
     if (line) free(line);
@@ -77,28 +249,51 @@ static char *main_state(void) {
     return NULL;
 }
 
-static void main_update(void) {
+static bool main_archiver(void) {
+    char *value;
+    if (strcmp(archiver, "standby")) return true;
+    if (!(value = main_conf_read(pg_save_conf, "archiver = '"))) return false;
+    return !strcmp(value, hostname);
+}
+
+static char *main_state(void) {
+    char *state;
+    if (!(state = main_conf_read(pg_save_conf, "state = '")) && !(state = main_conf_read(postgresql_auto_conf, "pg_save.state = '"))) return NULL;
+    pg_log_info("state = %s", state);
+    return state;
+}
+
+static void main_update_conf(const char *filename, const char *prefix) {
     char str[MAXPGPATH];
-    snprintf(str, sizeof(str), CMD(sed -i "/^primary_conninfo/cprimary_conninfo = 'host=%s application_name=%s target_session_attrs=read-write'" "%s"), primary, hostname, postgresql_auto_conf);
-    pg_log_info("%s", str);
-    if (system(str)) pg_log_error("system(\"%s\") and %m", str);
-    snprintf(str, sizeof(str), CMD(sed -i "/^pg_save.primary/cpg_save.primary = '%s'" "%s"), primary, postgresql_auto_conf);
+    struct stat sb;
+    if (stat(filename, &sb) || !S_ISREG(sb.st_mode)) return;
+    snprintf(str, sizeof(str), CMD(sed -i -e "/^%sprimary =/c%sprimary = '%s'" -e "/^%swait_primary =/c%swait_primary = '%s'" "%s"), prefix, prefix, primary, prefix, prefix, primary, filename);
     pg_log_info("%s", str);
     if (system(str)) pg_log_error("system(\"%s\") and %m", str);
-    snprintf(str, sizeof(str), CMD(sed -i "/^pg_save.wait_primary/cpg_save.wait_primary = '%s'" "%s"), primary, postgresql_auto_conf);
+}
+
+static void main_update(void) {
+    char str[MAXPGPATH];
+    snprintf(str, sizeof(str), CMD(sed -i "/^primary_conninfo/cprimary_conninfo = 'host=%s application_name=%s target_session_attrs=read-write'" "%s"), primary, hostname, postgresql_auto_conf);
     pg_log_info("%s", str);
     if (system(str)) pg_log_error("system(\"%s\") and %m", str);
+    main_update_conf(pg_save_conf, "");
+    main_update_conf(postgresql_auto_conf, "pg_save.");
 }
 
 static void main_check(void) {
     const char *state;
     struct stat sb;
     if (!stat(standby_signal, &sb) && S_ISREG(sb.st_mode)) {
-        if (primary) main_update();
+        if (primary && !stat(pg_save_resync, &sb) && S_ISREG(sb.st_mode)) {
+            if (unlink(pg_save_resync)) pg_log_error("unlink(\"%s\") and %m", pg_save_resync);
+            main_rewind();
+        } else if (primary) main_update();
     } else {
         if (!(state = main_state())) pg_log_error("!main_state");
         if (!strcmp(state, "wait_standby") && !primary) pg_log_error("pg_save.state == wait_standby && !primary");
-        if (primary) main_rewind();
+        if (primary && !main_diverged()) main_recovery();
+        else if (primary) main_rewind();
     }
 }
 
@@ -108,9 +303,9 @@ static void main_conf(void) {
     if (!(file = fopen(postgresql_auto_conf, "a"))) pg_log_error("fopen(\"%s\") and %m", postgresql_auto_conf);
     initPQExpBuffer(&buf);
     if (arclog) appendPQExpBuffer(&buf, CONF(
-        archive_command = 'gzip -cfk "%%p" >"%s/%%f.gz"'\n
-        archive_mode = 'on'\n
-    ), arclog);
+        archive_command = 'pg_save archive "%%p" "%%f"'\n
+        archive_mode = '%s'\n
+    ), strcmp(archiver, "standby") ? "on" : "always");
     if (cluster_name) appendPQExpBuffer(&buf, CONF(cluster_name = '%s'\n), cluster_name);
     appendPQExpBufferStr(&buf, CONF(
         datestyle = 'iso, dmy'\n
@@ -118,16 +313,14 @@ static void main_conf(void) {
         listen_addresses = '*'\n
         max_logical_replication_workers = '0'\n
         max_sync_workers_per_subscription = '0'\n
-        max_wal_senders = '3'\n
     ));
-    if (arclog) appendPQExpBuffer(&buf, CONF(restore_command = 'gunzip -cfk "%s/%%f.gz" >"%%p"'\n), arclog);
+    if (arclog) appendPQExpBufferStr(&buf, CONF(restore_command = 'pg_save restore "%f" "%p"'\n));
 #if PG_VERSION_NUM >= 120000
     appendPQExpBufferStr(&buf, CONF(
         shared_preload_libraries = 'pg_save'\n
     ));
 #endif
     appendPQExpBufferStr(&buf, CONF(
-        wal_compression = 'on'\n
         wal_level = 'replica'\n
         wal_log_hints = 'on'\n
         wal_receiver_create_temp_slot = 'on'\n
@@ -151,6 +344,112 @@ static void main_hba(void) {
     fclose(file);
 }
 
+static bool main_read(const char *filename, char *str, size_t size) {
+    FILE *file;
+    bool ok;
+    if (!(file = fopen(filename, "r"))) return false;
+    ok = fgets(str, size, file) != NULL;
+    fclose(file);
+    return ok;
+}
+
+static uint64 main_memory(void) {
+    char str[64];
+    uint64 memory = (uint64)sysconf(_SC_PHYS_PAGES) * (uint64)sysconf(_SC_PAGESIZE);
+    uint64 limit = 0;
+    if (main_read("/sys/fs/cgroup/memory.max", str, sizeof(str)) && strncmp(str, "max", sizeof("max") - 1)) limit = strtoull(str, NULL, 10);
+    else if (main_read("/sys/fs/cgroup/memory/memory.limit_in_bytes", str, sizeof(str))) limit = strtoull(str, NULL, 10);
+    return limit && limit < memory ? limit : memory;
+}
+
+static int main_cpus(void) {
+    char str[64];
+    int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    long period = 0, quota = 0;
+    if (main_read("/sys/fs/cgroup/cpu.max", str, sizeof(str))) {
+        if (strncmp(str, "max", sizeof("max") - 1) && sscanf(str, "%ld %ld", &quota, &period) != 2) quota = 0;
+    } else if (main_read("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", str, sizeof(str))) {
+        quota = strtol(str, NULL, 10);
+        if (main_read("/sys/fs/cgroup/cpu/cpu.cfs_period_us", str, sizeof(str))) period = strtol(str, NULL, 10);
+    }
+    if (quota > 0 && period > 0 && (quota + period - 1) / period < cpus) cpus = (quota + period - 1) / period;
+    return Max(cpus, 1);
+}
+
+static void main_profile_conf(PQExpBuffer buf) {
+    bool olap = !strcmp(profile, "olap");
+    const char *size = getenv("CLUSTER_SIZE");
+    int connections = olap ? 40 : 200;
+    int cpus = main_cpus();
+    int nodes = size ? atoi(size) : 0;
+    uint64 memory = main_memory() / (1024 * 1024);
+    uint64 shared_buffers = Max(memory / 4, 128);
+    bool hdd = !strcmp(storage, "hdd");
+    bool network = !strcmp(storage, "network");
+    pg_log_info("profile = %s, storage = %s, memory = %luMB, cpus = %i, nodes = %i", profile, storage, (unsigned long)memory, cpus, nodes);
+    appendPQExpBuffer(buf, "# pg_save profile = %s, storage = %s, memory = %luMB, cpus = %i, nodes = %i\n", profile, storage, (unsigned long)memory, cpus, nodes);
+    appendPQExpBuffer(buf, CONF(checkpoint_completion_target = '0.9'\n));
+    appendPQExpBuffer(buf, CONF(checkpoint_timeout = '%s'\n), olap ? "30min" : "15min");
+    appendPQExpBuffer(buf, CONF(effective_cache_size = '%luMB'\n), (unsigned long)Max(memory * 3 / 4, shared_buffers));
+    appendPQExpBuffer(buf, CONF(effective_io_concurrency = '%i'\n), hdd ? 2 : network ? 100 : 200);
+    appendPQExpBuffer(buf, CONF(maintenance_work_mem = '%luMB'\n), (unsigned long)Min(Max(memory / 16, 64), 2048));
+    appendPQExpBuffer(buf, CONF(max_connections = '%i'\n), 200);
+#if PG_VERSION_NUM >= 100000
+    appendPQExpBuffer(buf, CONF(max_parallel_workers = '%i'\n), Min(cpus, 24));
+#endif
+    appendPQExpBuffer(buf, CONF(max_parallel_workers_per_gather = '%i'\n), olap ? Max(cpus / 2, 1) : Min(cpus / 4, 2));
+    appendPQExpBuffer(buf, CONF(max_replication_slots = '%i'\n), Max(nodes + 2, 10));
+    appendPQExpBuffer(buf, CONF(max_wal_senders = '%i'\n), Max(nodes + 2, 10));
+    appendPQExpBuffer(buf, CONF(max_wal_size = '%luMB'\n), (unsigned long)Min(Max(memory, 1024), olap ? 65536 : 16384));
+    appendPQExpBuffer(buf, CONF(max_worker_processes = '%i'\n), 32);
+    appendPQExpBuffer(buf, CONF(min_wal_size = '%luMB'\n), (unsigned long)Min(Max(memory / 4, 80), 4096));
+    appendPQExpBuffer(buf, CONF(random_page_cost = '%s'\n), hdd ? "4" : network ? "1.5" : "1.1");
+    appendPQExpBuffer(buf, CONF(shared_buffers = '%luMB'\n), (unsigned long)shared_buffers);
+    appendPQExpBuffer(buf, CONF(wal_buffers = '%luMB'\n), (unsigned long)Min(Max(shared_buffers / 32, 1), 64));
+    appendPQExpBuffer(buf, CONF(wal_compression = '%s'\n), cpus > 1 || hdd || network ? "on" : "off");
+    appendPQExpBuffer(buf, CONF(work_mem = '%luMB'\n), (unsigned long)Max((memory > shared_buffers ? memory - shared_buffers : 0) / (connections * (olap ? 2 : 4)), 4));
+}
+
+static int main_profile_print(void) {
+    PQExpBufferData buf;
+    initPQExpBuffer(&buf);
+    main_profile_conf(&buf);
+    fwrite(buf.data, buf.len, 1, stdout);
+    termPQExpBuffer(&buf);
+    return 0;
+}
+
+static void main_include(void) {
+    char *line = NULL;
+    FILE *file;
+    size_t len = 0;
+    if (!(file = fopen(postgresql_conf, "r"))) pg_log_error("fopen(\"%s\") and %m", postgresql_conf);
+    while (getline(&line, &len, file) != -1) if (!strcmp(line, CONF(include_if_exists = 'pg_save.profile.conf'\n))) { free(line); fclose(file); return; }
+    if (line) free(line);
+    fclose(file);
+    if (!(file = fopen(postgresql_conf, "a"))) pg_log_error("fopen(\"%s\") and %m", postgresql_conf);
+    if (fputs(CONF(include_if_exists = 'pg_save.profile.conf'\n), file) == EOF) pg_log_error("fputs == EOF and %m");
+    fclose(file);
+}
+
+static void main_profile(void) {
+    char old[8192] = "";
+    FILE *file;
+    PQExpBufferData buf;
+    if (!strcmp(profile, "none")) { if (unlink(pg_save_profile_conf) && errno != ENOENT) pg_log_error("unlink(\"%s\") and %m", pg_save_profile_conf); return; }
+    main_include();
+    initPQExpBuffer(&buf);
+    main_profile_conf(&buf);
+    if ((file = fopen(pg_save_profile_conf, "r"))) { old[fread(old, 1, sizeof(old) - 1, file)] = '\0'; fclose(file); }
+    if (strcmp(old, buf.data)) {
+        pg_log_info("write \"%s\"", pg_save_profile_conf);
+        if (!(file = fopen(pg_save_profile_conf, "w"))) pg_log_error("fopen(\"%s\") and %m", pg_save_profile_conf);
+        if (fwrite(buf.data, buf.len, 1, file) != 1) pg_log_error("fwrite != 1 and %m");
+        fclose(file);
+    }
+    termPQExpBuffer(&buf);
+}
+
 static void main_initdb(void) {
     char str[MAXPGPATH];
     snprintf(str, sizeof(str), CMD(initdb --data-checksums --pgdata="%s"), pgdata);
@@ -184,6 +483,46 @@ static void main_init(void) {
     }
 }
 
+static const char *main_journal2char(int32 type) {
+    static const char *types[] = {
+#define XX(name) #name,
+        JOURNAL_MAP(XX)
+#undef XX
+    };
+    return type >= 0 && type < countof(types) ? types[type] : "(unknown)";
+}
+
+static const char *main_state2char(int32 state) {
+    static const char *states[] = {
+#define XX(name) #name,
+        STATE_MAP(XX)
+#undef XX
+    };
+    return state >= 0 && state < countof(states) ? states[state] : "(unknown)";
+}
+
+static int main_journal(void) {
+    char filename[MAXPGPATH];
+    FILE *file;
+    Journal journal;
+    snprintf(filename, sizeof(filename), "%s/%s", pgdata, "pg_save.journal");
+    if (!(file = fopen(filename, "r"))) { pg_log_error("fopen(\"%s\") and %m", filename); return 1; }
+    if (fread(&journal, offsetof(Journal, records), 1, file) != 1) { pg_log_error("fread != 1 and %m"); fclose(file); return 1; }
+    if (journal.magic != JOURNAL_MAGIC || !journal.count) { pg_log_error("journal.magic = %u", journal.magic); fclose(file); return 1; }
+    for (uint64 next = journal.next > journal.count ? journal.next - journal.count : 0; next < journal.next; next++) {
+        char str[sizeof("YYYY-MM-DD HH:MM:SS")];
+        JournalRecord record;
+        time_t time;
+        if (fseeko(file, offsetof(Journal, records) + (next % journal.count) * sizeof(record), SEEK_SET)) { pg_log_error("fseeko and %m"); fclose(file); return 1; }
+        if (fread(&record, sizeof(record), 1, file) != 1) { pg_log_error("fread != 1 and %m"); fclose(file); return 1; }
+        time = (time_t)(record.time / USECS_PER_SEC + (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY);
+        strftime(str, sizeof(str), "%Y-%m-%d %H:%M:%S", localtime(&time));
+        printf("%s.%06i %i %s %s %s %i %s\n", str, (int)(record.time % USECS_PER_SEC), record.pid, main_journal2char(record.type), record.host[0] != '\0' ? record.host : "-", main_state2char(record.state), record.value, record.data[0] != '\0' ? record.data : "-");
+    }
+    fclose(file);
+    return 0;
+}
+
 static char *main_primary(void) {
     static char primary[MAXPGPATH];
     PGconn *conn;
@@ -211,7 +550,25 @@ int main(int argc, char *argv[]) {
     set_pglocale_pgservice(argv[0], PG_TEXTDOMAIN("pg_save"));
     if (!(hostname = getenv("HOSTNAME"))) pg_log_error("!getenv(\"HOSTNAME\")");
     if (!(pgdata = getenv("PGDATA"))) pg_log_error("!getenv(\"PGDATA\")");
-    arclog = getenv("ARCLOG");
+    if (argc > 1 && !strcmp(argv[1], "journal")) return main_journal();
+    if ((arclog = getenv("ARCLOG"))) {
+        if (is_absolute_path(arclog)) strlcpy(arclog_dir, arclog, sizeof(arclog_dir));
+        else snprintf(arclog_dir, sizeof(arclog_dir), "%s/%s", pgdata, arclog);
+    }
+    if (!(archiver = getenv("ARCHIVER"))) archiver = "primary";
+    if (strcmp(archiver, "primary") && strcmp(archiver, "standby")) pg_log_error("ARCHIVER = %s is not primary or standby", archiver);
+    if (!strcmp(archiver, "standby") && arclog && !is_absolute_path(arclog)) pg_log_error("ARCHIVER = standby requires absolute ARCLOG = %s", arclog);
+    snprintf(pg_save_conf, sizeof(pg_save_conf), "%s/%s", pgdata, "pg_save.conf");
+    if (argc > 1 && (!strcmp(argv[1], "archive") || !strcmp(argv[1], "restore") || !strcmp(argv[1], "prune") || !strcmp(argv[1], "verify")) && !arclog) { pg_log_error("!getenv(\"ARCLOG\")"); return 1; }
+    if (argc > 3 && !strcmp(argv[1], "archive")) return archive_archive(arclog_dir, argv[2], argv[3], main_archiver());
+    if (argc > 3 && !strcmp(argv[1], "restore")) return archive_restore(arclog_dir, argv[2], argv[3]);
+    if (argc > 1 && !strcmp(argv[1], "prune")) return archive_prune(arclog_dir);
+    if (argc > 1 && !strcmp(argv[1], "verify")) return archive_verify(arclog_dir);
+    if (!(profile = getenv("PROFILE"))) profile = "oltp";
+    if (!(storage = getenv("STORAGE"))) storage = "ssd";
+    if (strcmp(profile, "oltp") && strcmp(profile, "olap") && strcmp(profile, "none")) pg_log_error("PROFILE = %s is not oltp, olap or none", profile);
+    if (strcmp(storage, "ssd") && strcmp(storage, "hdd") && strcmp(storage, "network")) pg_log_error("STORAGE = %s is not ssd, hdd or network", storage);
+    if (argc > 1 && !strcmp(argv[1], "profile")) return main_profile_print();
     primary_conninfo = getenv("PRIMARY_CONNINFO");
     cluster_name = getenv("CLUSTER_NAME");
     primary = main_primary();
@@ -222,14 +579,23 @@ int main(int argc, char *argv[]) {
     if (primary_conninfo) pg_log_info("primary_conninfo = '%s'", primary_conninfo);
     if (primary) pg_log_info("primary = '%s'", primary);
     if (pg_mkdir_p((char *)pgdata, pg_dir_create_mode) == -1) pg_log_error("pg_mkdir_p(\"%s\") == -1 and %m", pgdata);
-    if (arclog) {
-        char filename[MAXPGPATH];
-        snprintf(filename, sizeof(filename), "%s/%s", pgdata, arclog);
-        if (pg_mkdir_p(filename, pg_dir_create_mode) == -1) pg_log_error("pg_mkdir_p(\"%s\") == -1 and %m", filename);
-    }
+    if (arclog && pg_mkdir_p(arclog_dir, pg_dir_create_mode) == -1) pg_log_error("pg_mkdir_p(\"%s\") == -1 and %m", arclog_dir);
     snprintf(pg_hba_conf, sizeof(pg_hba_conf), "%s/%s", pgdata, "pg_hba.conf");
+    snprintf(pg_save_profile_conf, sizeof(pg_save_profile_conf), "%s/%s", pgdata, "pg_save.profile.conf");
+    snprintf(pg_save_resync, sizeof(pg_save_resync), "%s/%s", pgdata, "pg_save.resync");
     snprintf(postgresql_auto_conf, sizeof(postgresql_auto_conf), "%s/%s", pgdata, "postgresql.auto.conf");
+    snprintf(postgresql_conf, sizeof(postgresql_conf), "%s/%s", pgdata, "postgresql.conf");
     snprintf(standby_signal, sizeof(standby_signal), "%s/%s", pgdata, "standby.signal");
+    if (argc > 1 && !strcmp(argv[1], "resync")) {
+        char pid[MAXPGPATH];
+        struct stat sb;
+        snprintf(pid, sizeof(pid), "%s/%s", pgdata, "postmaster.pid");
+        if (!primary) { pg_log_error("!primary"); return 1; }
+        if (!stat(pid, &sb)) { pg_log_error("\"%s\" exists, stop server before resync", pid); return 1; }
+        if (!main_resync()) return 1;
+        main_recovery();
+        return 0;
+    }
     switch (pg_check_dir(pgdata)) {
         case 0: pg_log_error("directory \"%s\" does not exist", pgdata); break;
         case 1: pg_log_info("directory \"%s\" exists and empty", pgdata); main_init(); break;
@@ -238,6 +604,7 @@ int main(int argc, char *argv[]) {
         case 4: pg_log_info("directory \"%s\" exists and not empty", pgdata); main_check(); break;
         case -1: pg_log_error("pg_check_dir(\"%s\") == -1 and %m", pgdata); break;
     }
+    main_profile();
     execlp("postmaster", "postmaster", NULL);
     pg_log_error("execlp(\"postmaster\")");
 }
@@ -0,0 +1,296 @@
+#include "bin.h"
+
+#define RESYNC_RANGE 128
+
+typedef struct ResyncFile {
+    char *path;
+    int64 size;
+} ResyncFile;
+
+typedef struct ResyncStat {
+    uint64 blocks;
+    uint64 bytes;
+    uint64 differ;
+    uint64 files;
+} ResyncStat;
+
+static const char *resync_conninfo;
+static const char *resync_exclude[] = {
+#define XX(name) name,
+    RESYNC_EXCLUDE_MAP(XX)
+#undef XX
+};
+static const char *resync_pgdata;
+static int resync_count = 0;
+static ResyncFile *resync_files = NULL;
+static ResyncStat *resync_stats = NULL;
+
+static int64 resync_int64(const char *data) {
+    uint64 value = 0;
+    for (int i = 0; i < sizeof(value); i++) value = (value << 8) | (unsigned char)data[i];
+    return (int64)value;
+}
+
+static int resync_cmp(const void *a, const void *b) {
+    return strcmp(((const ResyncFile *)a)->path, ((const ResyncFile *)b)->path);
+}
+
+static PGconn *resync_connect(void) {
+    PGconn *conn;
+    if (!(conn = PQconnectdb(resync_conninfo)) || PQstatus(conn) != CONNECTION_OK) { pg_log_error("!PQconnectdb and %s", PQerrorMessageMy(conn)); if (conn) PQfinish(conn); return NULL; }
+    return conn;
+}
+
+static PGresult *resync_exec(PGconn *conn, const char *command, int nParams, const char *const *values, int format, ExecStatusType status) {
+    PGresult *result;
+    if (!(result = PQexecParams(conn, command, nParams, NULL, values, NULL, NULL, format))) { pg_log_error("!PQexecParams and %s", PQerrorMessageMy(conn)); return NULL; }
+    if (PQresultStatus(result) != status) { pg_log_error("PQresultStatus = %s and %s", PQresStatus(PQresultStatus(result)), PQresultErrorMessageMy(result)); PQclear(result); return NULL; }
+    return result;
+}
+
+static bool resync_excluded(const char *path) {
+    char arclog[MAXPGPATH];
+    const char *env = getenv("ARCLOG");
+    for (int i = 0; i < countof(resync_exclude); i++) if (!strcmp(path, resync_exclude[i])) return true;
+    if (!env || is_absolute_path(env)) return false;
+    strlcpy(arclog, env, sizeof(arclog));
+    canonicalize_path(arclog);
+    return !strcmp(path, arclog);
+}
+
+static bool resync_fetch(PGconn *conn, int fd, const char *path, int64 offset, int64 length, ResyncStat *stats) {
+    char len[MAXINT8LEN + 1];
+    char off[MAXINT8LEN + 1];
+    const char *values[] = {path, off, len};
+    PGresult *result;
+    snprintf(off, sizeof(off), INT64_FORMAT, offset);
+    snprintf(len, sizeof(len), INT64_FORMAT, length);
+    if (!(result = resync_exec(conn, "SELECT pg_read_binary_file($1, $2::bigint, $3::bigint)", countof(values), values, 1, PGRES_TUPLES_OK))) return false;
+    if (PQntuples(result) != 1 || PQgetisnull(result, 0, 0)) { pg_log_error("\"%s\" is missing on source", path); PQclear(result); return false; }
+    if (pwrite(fd, PQgetvalue(result, 0, 0), PQgetlength(result, 0, 0), offset) != PQgetlength(result, 0, 0)) { pg_log_error("pwrite(\"%s\") and %m", path); PQclear(result); return false; }
+    stats->bytes += PQgetlength(result, 0, 0);
+    PQclear(result);
+    return true;
+}
+
+static bool resync_file(PGconn *conn, const ResyncFile *file, ResyncStat *stats) {
+    char buf[BLCKSZ];
+    char filename[MAXPGPATH];
+    const char *checksums;
+    const char *values[] = {file->path};
+    int fd;
+    int64 count;
+    int64 size;
+    int64 start = -1;
+    PGresult *result;
+    snprintf(filename, sizeof(filename), "%s/%s", resync_pgdata, file->path);
+    if (!(result = resync_exec(conn, "SELECT size, checksums FROM pg_save_resync_checksum($1)", countof(values), values, 1, PGRES_TUPLES_OK))) return false;
+    if (PQntuples(result) != 1 || PQgetisnull(result, 0, 0)) { PQclear(result); if (unlink(filename) && errno != ENOENT) { pg_log_error("unlink(\"%s\") and %m", filename); return false; } return true; }
+    size = resync_int64(PQgetvalue(result, 0, 0));
+    checksums = PQgetvalue(result, 0, 1);
+    count = PQgetlength(result, 0, 1) / sizeof(ResyncDigest);
+    if ((fd = open(filename, O_RDWR | O_CREAT | PG_BINARY, pg_file_create_mode)) == -1) {
+        char dir[MAXPGPATH];
+        strlcpy(dir, filename, sizeof(dir));
+        get_parent_directory(dir);
+        if (errno != ENOENT || pg_mkdir_p(dir, pg_dir_create_mode) == -1 || (fd = open(filename, O_RDWR | O_CREAT | PG_BINARY, pg_file_create_mode)) == -1) { pg_log_error("open(\"%s\") and %m", filename); PQclear(result); return false; }
+    }
+    for (int64 block = 0; block <= count; block++) {
+        bool differ = false;
+        if (block < count) {
+            pg_crc32c crc;
+            ssize_t len = Min(BLCKSZ, size - block * BLCKSZ);
+            ResyncDigest digest = {0};
+            if (pread(fd, buf, len, block * BLCKSZ) != len) differ = true;
+            else {
+                INIT_CRC32C(crc);
+                COMP_CRC32C(crc, buf, len);
+                FIN_CRC32C(crc);
+                digest.crc = htonl(crc);
+                if (len >= sizeof(digest.lsn)) memcpy(digest.lsn, buf, sizeof(digest.lsn));
+                differ = memcmp(&digest, checksums + block * sizeof(digest), sizeof(digest)) != 0;
+            }
+            stats->blocks++;
+            if (differ) stats->differ++;
+        }
+        if (differ && start < 0) start = block;
+        if (start >= 0 && (!differ || block - start >= RESYNC_RANGE)) {
+            if (!resync_fetch(conn, fd, file->path, start * BLCKSZ, Min(block * BLCKSZ, size) - start * BLCKSZ, stats)) { close(fd); PQclear(result); return false; }
+            start = differ ? block : -1;
+        }
+    }
+    PQclear(result);
+    if (ftruncate(fd, size)) { pg_log_error("ftruncate(\"%s\") and %m", filename); close(fd); return false; }
+    if (fsync(fd)) { pg_log_error("fsync(\"%s\") and %m", filename); close(fd); return false; }
+    close(fd);
+    stats->files++;
+    return true;
+}
+
+static bool resync_remove(const char *dir) {
+    char dirname[MAXPGPATH];
+    DIR *dirp;
+    struct dirent *de;
+    snprintf(dirname, sizeof(dirname), "%s%s%s", resync_pgdata, dir[0] != '\0' ? "/" : "", dir);
+    if (!(dirp = opendir(dirname))) { pg_log_error("opendir(\"%s\") and %m", dirname); return false; }
+    while ((de = readdir(dirp))) {
+        char filename[MAXPGPATH];
+        char path[MAXPGPATH];
+        ResyncFile key = {path, 0};
+        struct stat sb;
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+        if (dir[0] != '\0') snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        else strlcpy(path, de->d_name, sizeof(path));
+        if (resync_excluded(path)) continue;
+        snprintf(filename, sizeof(filename), "%s/%s", resync_pgdata, path);
+        if (stat(filename, &sb)) { pg_log_error("stat(\"%s\") and %m", filename); closedir(dirp); return false; }
+        if (S_ISDIR(sb.st_mode)) { if (!resync_remove(path)) { closedir(dirp); return false; } continue; }
+        if (!S_ISREG(sb.st_mode) || bsearch(&key, resync_files, resync_count, sizeof(*resync_files), resync_cmp)) continue;
+        pg_log_info("remove \"%s\"", filename);
+        if (unlink(filename)) { pg_log_error("unlink(\"%s\") and %m", filename); closedir(dirp); return false; }
+    }
+    closedir(dirp);
+    return true;
+}
+
+static bool resync_list(PGconn *conn) {
+    PGresult *result;
+    if (!(result = resync_exec(conn, "SELECT path, size FROM pg_save_resync_files() ORDER BY path COLLATE \"C\"", 0, NULL, 0, PGRES_TUPLES_OK))) return false;
+    resync_count = PQntuples(result);
+    if (!(resync_files = calloc(Max(resync_count, 1), sizeof(*resync_files)))) { pg_log_error("calloc and %m"); PQclear(result); return false; }
+    for (int row = 0; row < resync_count; row++) {
+        if (!(resync_files[row].path = strdup(PQgetvalue(result, row, 0)))) { pg_log_error("strdup and %m"); PQclear(result); return false; }
+        resync_files[row].size = strtoll(PQgetvalue(result, row, 1), NULL, 10);
+    }
+    PQclear(result);
+    return true;
+}
+
+static bool resync_parallel(int jobs) {
+    bool ok = true;
+    pid_t *pids;
+    if (!(pids = calloc(jobs, sizeof(*pids)))) { pg_log_error("calloc and %m"); return false; }
+    if ((resync_stats = mmap(NULL, jobs * sizeof(*resync_stats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) { pg_log_error("mmap and %m"); resync_stats = NULL; free(pids); return false; }
+    fflush(NULL);
+    for (int job = 0; job < jobs; job++) switch ((pids[job] = fork())) {
+        case -1: pg_log_error("fork and %m"); pids[job] = 0; ok = false; break;
+        case 0: {
+            PGconn *conn;
+            if (!(conn = resync_connect())) exit(1);
+            for (int i = job; i < resync_count; i += jobs) if (!resync_file(conn, &resync_files[i], &resync_stats[job])) { PQfinish(conn); exit(1); }
+            PQfinish(conn);
+            exit(0);
+        }
+        default: break;
+    }
+    for (int job = 0; job < jobs; job++) {
+        int status;
+        if (!pids[job]) continue;
+        if (waitpid(pids[job], &status, 0) == -1) { pg_log_error("waitpid and %m"); ok = false; continue; }
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) ok = false;
+    }
+    free(pids);
+    return ok;
+}
+
+static bool resync_write(const char *name, const char *data) {
+    char filename[MAXPGPATH];
+    FILE *file;
+    snprintf(filename, sizeof(filename), "%s/%s", resync_pgdata, name);
+    if (!(file = fopen(filename, "w"))) { pg_log_error("fopen(\"%s\") and %m", filename); return false; }
+    if (fwrite(data, strlen(data), 1, file) != 1) { pg_log_error("fwrite(\"%s\") and %m", filename); fclose(file); return false; }
+    fclose(file);
+    return true;
+}
+
+static bool resync_wal(PGconn *conn, const char *labelfile) {
+    char start[MAXFNAMELEN] = "";
+    char wal[MAXPGPATH];
+    const char *line;
+    const char *values[] = {start};
+    PGresult *result;
+    bool ok = true;
+    if (!(line = strstr(labelfile, "START WAL LOCATION: ")) || sscanf(line, "START WAL LOCATION: %*X/%*X (file %24s)", start) != 1) { pg_log_error("no START WAL LOCATION in backup label"); return false; }
+    snprintf(wal, sizeof(wal), "%s/%s", resync_pgdata, XLOGDIR);
+    if (!rmtree(wal, false)) { pg_log_error("rmtree(\"%s\")", wal); return false; }
+    snprintf(wal, sizeof(wal), "%s/%s/archive_status", resync_pgdata, XLOGDIR);
+    if (pg_mkdir_p(wal, pg_dir_create_mode) == -1) { pg_log_error("pg_mkdir_p(\"%s\") and %m", wal); return false; }
+    if (!(result = resync_exec(conn, "SELECT name FROM pg_ls_waldir() WHERE name ~ '[.]history$' OR (name ~ '^[0-9A-F]{24}$' AND substr(name, 9) >= substr($1, 9)) ORDER BY name", countof(values), values, 0, PGRES_TUPLES_OK))) return false;
+    for (int row = 0; ok && row < PQntuples(result); row++) {
+        char path[MAXPGPATH];
+        const char *name = PQgetvalue(result, row, 0);
+        const char *args[] = {path};
+        PGresult *data;
+        snprintf(path, sizeof(path), "%s/%s", XLOGDIR, name);
+        pg_log_info("fetch \"%s\"", path);
+        if (!(data = resync_exec(conn, "SELECT pg_read_binary_file($1)", countof(args), args, 1, PGRES_TUPLES_OK))) { ok = false; break; }
+        snprintf(wal, sizeof(wal), "%s/%s", resync_pgdata, path);
+        if (PQntuples(data) == 1 && !PQgetisnull(data, 0, 0)) {
+            FILE *file;
+            if (!(file = fopen(wal, "w"))) { pg_log_error("fopen(\"%s\") and %m", wal); ok = false; }
+            else {
+                if (fwrite(PQgetvalue(data, 0, 0), PQgetlength(data, 0, 0), 1, file) != 1) { pg_log_error("fwrite(\"%s\") and %m", wal); ok = false; }
+                fclose(file);
+            }
+        }
+        PQclear(data);
+    }
+    PQclear(result);
+    return ok;
+}
+
+int resync_resync(const char *pgdata, const char *conninfo) {
+    const char *env = getenv("RESYNC_JOBS");
+    int jobs = env ? atoi(env) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    instr_time start_time;
+    instr_time cur_time;
+    PGconn *conn;
+    PGresult *result;
+    ResyncStat total = {0};
+    char slot[NAMEDATALEN];
+    const char *slots[] = {slot};
+    const char *values[] = {"pg_save resync"};
+    bool ok;
+    resync_conninfo = conninfo;
+    resync_pgdata = pgdata;
+    INSTR_TIME_SET_CURRENT(start_time);
+    pg_log_info("resync from \"%s\"", conninfo);
+    if (!(conn = resync_connect())) return 1;
+    snprintf(slot, sizeof(slot), "pg_save_resync_%i", (int)getpid());
+    if (!(result = resync_exec(conn, "SELECT pg_create_physical_replication_slot($1, true, true)", countof(slots), slots, 0, PGRES_TUPLES_OK))) { PQfinish(conn); return 1; }
+    PQclear(result);
+#if PG_VERSION_NUM >= 150000
+    if (!(result = resync_exec(conn, "SELECT pg_backup_start($1, true)", countof(values), values, 0, PGRES_TUPLES_OK))) { PQfinish(conn); return 1; }
+#else
+    if (!(result = resync_exec(conn, "SELECT pg_start_backup($1, true, false)", countof(values), values, 0, PGRES_TUPLES_OK))) { PQfinish(conn); return 1; }
+#endif
+    PQclear(result);
+    if ((ok = resync_list(conn))) {
+        jobs = Max(Min(jobs, resync_count), 1);
+        pg_log_info("files = %i, jobs = %i", resync_count, jobs);
+        ok = resync_remove("") && resync_parallel(jobs);
+    }
+#if PG_VERSION_NUM >= 150000
+    if (!(result = resync_exec(conn, "SELECT labelfile, spcmapfile FROM pg_backup_stop(false)", 0, NULL, 0, PGRES_TUPLES_OK))) { PQfinish(conn); return 1; }
+#else
+    if (!(result = resync_exec(conn, "SELECT labelfile, spcmapfile FROM pg_stop_backup(false, false)", 0, NULL, 0, PGRES_TUPLES_OK))) { PQfinish(conn); return 1; }
+#endif
+    if (ok) ok = resync_wal(conn, PQgetvalue(result, 0, 0));
+    if (ok) ok = resync_write("backup_label", PQgetvalue(result, 0, 0));
+    if (ok && !PQgetisnull(result, 0, 1) && PQgetvalue(result, 0, 1)[0] != '\0') ok = resync_write("tablespace_map", PQgetvalue(result, 0, 1));
+    PQclear(result);
+    PQfinish(conn);
+    for (int job = 0; resync_stats && job < jobs; job++) {
+        total.blocks += resync_stats[job].blocks;
+        total.bytes += resync_stats[job].bytes;
+        total.differ += resync_stats[job].differ;
+        total.files += resync_stats[job].files;
+    }
+    INSTR_TIME_SET_CURRENT(cur_time);
+    INSTR_TIME_SUBTRACT(cur_time, start_time);
+    pg_log_info("resync %s: files = " UINT64_FORMAT ", blocks = " UINT64_FORMAT ", differ = " UINT64_FORMAT ", bytes = " UINT64_FORMAT ", time = %.3f s", ok ? "done" : "failed", total.files, total.blocks, total.differ, total.bytes, INSTR_TIME_GET_DOUBLE(cur_time));
+    if (resync_stats) munmap(resync_stats, jobs * sizeof(*resync_stats));
+    for (int i = 0; i < resync_count; i++) free(resync_files[i].path);
+    if (resync_files) free(resync_files);
+    return ok ? 0 : 1;
+}
@@ -1,3 +1,5 @@
+#include <postgres_fe.h>
+
 #include "common.h"
 
 char *PQerrorMessageMy(const PGconn *conn) {
@@ -4,6 +4,13 @@
 #include <postgres.h>
 
 #include "common.h"
+#include <access/xlog_internal.h>
+#include <arpa/inet.h>
+#include <catalog/pg_control.h>
+#include <common/controldata_utils.h>
+#include <datatype/timestamp.h>
+#include <dirent.h>
+#include <fcntl.h>
 #if PG_VERSION_NUM >= 110000
 #include <common/file_perm.h>
 #else
@@ -24,7 +31,27 @@
 #define unlikely(x) ((x) != 0)
 #endif
 #endif
+#include <port/pg_crc32c.h>
+#include <portability/instr_time.h>
 #include <pqexpbuffer.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+typedef struct ArchiveRecord {
+    char name[64];
+    int64 time;
+    pg_crc32c crc;
+    uint32 timeline;
+    uint64 size;
+} ArchiveRecord;
+
+int archive_archive(const char *dir, const char *path, const char *name, bool archiver);
+int archive_prune(const char *dir);
+int archive_restore(const char *dir, const char *name, const char *path);
+int archive_verify(const char *dir);
+int resync_resync(const char *pgdata, const char *conninfo);
+
 #endif // _BIN_H_
@@ -9,6 +9,42 @@
 #define CONF(...) #__VA_ARGS__
 #define SQL(...) #__VA_ARGS__
 
+#define JOURNAL_MAGIC 0x53415645
+
+#define JOURNAL_MAP(XX) \
+    XX(state) \
+    XX(host) \
+    XX(system) \
+    XX(reload) \
+    XX(fail) \
+    XX(promote) \
+    XX(kill) \
+    XX(switchover) \
+    XX(resync) \
+    XX(latency) \
+    XX(lease) \
+    XX(start)
+
+#define RESYNC_EXCLUDE_MAP(XX) \
+    XX("backup_label") \
+    XX("pg_dynshmem") \
+    XX("pg_notify") \
+    XX("pg_replslot") \
+    XX("pg_save.conf") \
+    XX("pg_save.history") \
+    XX("pg_save.journal") \
+    XX("pg_save.resync") \
+    XX("pg_serial") \
+    XX("pg_snapshots") \
+    XX("pg_stat_tmp") \
+    XX("pg_subtrans") \
+    XX("pg_wal") \
+    XX("postmaster.opts") \
+    XX("postmaster.pid") \
+    XX("recovery.signal") \
+    XX("standby.signal") \
+    XX("tablespace_map")
+
 #define STATE_MAP(XX) \
     XX(unknown) \
     XX(initial) \
@@ -21,6 +57,28 @@
     XX(quorum) \
     XX(async)
 
+typedef struct JournalRecord {
+    char data[2 * NAMEDATALEN];
+    char host[NAMEDATALEN];
+    int32 pid;
+    int32 state;
+    int32 type;
+    int32 value;
+    int64 time;
+} JournalRecord;
+
+typedef struct Journal {
+    uint32 magic;
+    uint32 count;
+    uint64 next;
+    JournalRecord records[FLEXIBLE_ARRAY_MEMBER];
+} Journal;
+
+typedef struct ResyncDigest {
+    uint32 crc;
+    uint32 lsn[2];
+} ResyncDigest;
+
 char *PQerrorMessageMy(const PGconn *conn);
 char *PQresultErrorMessageMy(const PGresult *res);
 
@@ -3,13 +3,24 @@
 
 #include <postgres.h>
 
+#include <access/htup_details.h>
 #include <access/xact.h>
+#include <access/xlog.h>
+#if PG_VERSION_NUM >= 150000
+#include <access/xlogrecovery.h>
+#endif
+#include <arpa/inet.h>
+#include <catalog/pg_type.h>
 #include <commands/async.h>
 #include "common.h"
 #include <executor/spi.h>
+#include <fcntl.h>
 #include <funcapi.h>
 #include <libpq/libpq-be.h>
+#include <math.h>
+#include <netdb.h>
 #include <pgstat.h>
+#include <port/pg_crc32c.h>
 #include <postmaster/bgworker.h>
 #include <postmaster/bgwriter.h>
 #if PG_VERSION_NUM >= 130000
@@ -19,24 +30,57 @@ extern PGDLLIMPORT volatile sig_atomic_t ShutdownRequestPending;
 extern void SignalHandlerForConfigReload(SIGNAL_ARGS);
 extern void SignalHandlerForShutdownRequest(SIGNAL_ARGS);
 #endif
+#include <replication/walreceiver.h>
+#include <replication/walsender.h>
 #include <replication/walsender_private.h>
 #include <miscadmin.h>
-#if PG_VERSION_NUM >= 140000
+#include <storage/bufmgr.h>
+#include <storage/fd.h>
+#include <storage/ipc.h>
+#include <storage/lwlock.h>
+#include <storage/dsm.h>
 #include <storage/proc.h>
-#endif
+#include <storage/shm_mq.h>
+#include <storage/shmem.h>
+#include <storage/smgr.h>
+#include <storage/spin.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <tcop/utility.h>
 #include <unistd.h>
 #include <utils/builtins.h>
 #include <utils/memutils.h>
 #include <utils/snapmgr.h>
 #include <utils/timeout.h>
+#include <utils/timestamp.h>
+#include <utils/tuplestore.h>
+#if PG_VERSION_NUM >= 100000
+#include <utils/varlena.h>
+#endif
 
 #if PG_VERSION_NUM >= 100000
 #else
 #define WL_SOCKET_MASK (WL_SOCKET_READABLE | WL_SOCKET_WRITEABLE)
 #endif
 
+#define HELPER_QUEUE_SIZE 65536
+#define INIT_BACKOFF_MAX 3600
+#define SHMEM_PEERS 32
+
+typedef enum helper_t {
+    helper_checkpoint_type,
+    helper_reload_type,
+    helper_resolve_type,
+    helper_system_type
+} helper_t;
+
+typedef enum journal_t {
+#define XX(name) journal_##name,
+    JOURNAL_MAP(XX)
+#undef XX
+} journal_t;
+
 typedef enum state_t {
 #define XX(name) state_##name,
     STATE_MAP(XX)
@@ -45,7 +89,11 @@ typedef enum state_t {
 
 typedef struct Backend {
     char *host;
+    char *hostaddr;
     dlist_node node;
+    double jitter;
+    double rtt;
+    instr_time ping;
     int attempt;
     int event;
     PGconn *conn;
@@ -53,34 +101,110 @@ typedef struct Backend {
     void (*socket) (struct Backend *backend);
 } Backend;
 
+typedef struct Helper {
+    slock_t mutex;
+    uint64 done;
+} Helper;
+
+typedef struct HelperMessage {
+    int32 type;
+    int32 value;
+    uint32 name_len;
+    char data[FLEXIBLE_ARRAY_MEMBER];
+} HelperMessage;
+
+typedef struct Peer {
+    char host[NAMEDATALEN];
+    double jitter;
+    double rtt;
+    TimestampTz time;
+} Peer;
+
+typedef struct Resolve {
+    bool pending;
+    bool resolved;
+    char *host;
+    char *hostaddr;
+    dlist_node node;
+    TimestampTz time;
+} Resolve;
+
+typedef struct Shmem {
+    char archiver[NAMEDATALEN];
+    char switchover[NAMEDATALEN];
+    Peer peers[SHMEM_PEERS];
+    slock_t mutex;
+    TimestampTz switchover_time;
+} Shmem;
+
 Backend *backend_host(const char *host);
 Backend *backend_state(state_t state);
+bool backend_idling(Backend *backend);
+bool backend_pinging(Backend *backend);
+bool helper_checkpoint(int flags);
+bool helper_reload(void);
+bool helper_resolve(const char *host);
+bool helper_system(const char *name, const char *new);
+bool init_governor(void);
+bool prewarm_due(void);
+bool standby_promoting(void);
+bool standby_switchover(Backend *backend);
+char *init_archiver(void);
+char *init_switchover(void);
 char *TextDatumGetCStringMy(MemoryContext memoryContext, Datum datum);
 const char *init_state2char(state_t state);
+const char *init_state2host(state_t state);
+const char *journal_type2char(journal_t type);
+Datum SPI_getbinval_fnumber_my(HeapTupleData *tuple, TupleDesc tupdesc, int fnumber, bool allow_null);
 Datum SPI_getbinval_my(HeapTupleData *tuple, TupleDesc tupdesc, const char *fname, bool allow_null);
+int backend_count(void);
 int backend_nevents(void);
+int SPI_fnumber_my(TupleDesc tupdesc, const char *fname);
 SPIPlanPtr SPI_prepare_my(const char *src, int nargs, Oid *argtypes);
 state_t init_char2state(const char *state);
 state_t init_host(const char *host);
+uint32 init_hash(const char *str, uint32 seed);
 void backend_create(const char *host, state_t state);
 void backend_event(WaitEventSet *set);
 void backend_finish(Backend *backend);
 void backend_fini(void);
+void backend_foreach(void (*callback) (Backend *backend));
 void backend_idle(Backend *backend);
 void backend_init(void);
 void backend_readable(Backend *backend);
+void backend_reset(Backend *backend);
+void backend_resolved(const char *host, const char *hostaddr);
 void backend_result(const char *host, state_t state);
 void backend_timeout(void);
+void backend_topology(StringInfo buf);
 void backend_update(Backend *backend, state_t state);
 void backend_writeable(Backend *backend);
+void backup_timeout(void);
+void helper_fini(void);
+void helper_flush(void);
+void helper_init(void);
+void helper_receive(void);
+void init_alter_system(const char *name, const char *new);
 void init_backend(void);
 void init_debug(void);
+void init_kill(int sig);
+void init_read(void);
 void init_reload(void);
+void init_set_archiver(const char *host);
 void init_set_host(const char *host, state_t state);
+void init_set_peer(const char *host, double rtt, double jitter);
 void init_set_state(state_t state);
+void init_set_switchover(const char *target);
 void init_set_system(const char *name, const char *new);
+void init_started(void);
+void init_write(void);
 void initStringInfoMy(MemoryContext memoryContext, StringInfoData *buf);
 void _PG_init(void);
+void journal_startup(void);
+void journal_write(journal_t type, const char *host, state_t state, int value, const char *data);
+void prewarm_fini(void);
+void prewarm_select(Backend *backend);
+void prewarm_timeout(void);
 void primary_connected(Backend *backend);
 void primary_created(Backend *backend);
 void primary_failed(Backend *backend);
@@ -89,6 +213,8 @@ void primary_fini(void);
 void primary_init(void);
 void primary_timeout(void);
 void primary_updated(Backend *backend);
+void save_helper(Datum main_arg);
+void save_resolver(Datum main_arg);
 void save_worker(Datum main_arg);
 void SPI_commit_my(void);
 void SPI_connect_my(const char *src);
@@ -102,6 +228,7 @@ void standby_failed(Backend *backend);
 void standby_finished(Backend *backend);
 void standby_fini(void);
 void standby_init(void);
+void standby_notified(Backend *backend);
 void standby_timeout(void);
 void standby_updated(Backend *backend);
 void standby_update(state_t state);
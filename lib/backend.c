@@ -2,9 +2,15 @@
 
 extern char *hostname;
 extern int init_attempt;
+extern int init_resolve_ttl;
+extern int init_timeout;
 extern state_t init_state;
+MemoryContext backend_context;
 static char *pgport;
 static dlist_head backends = DLIST_STATIC_INIT(backends);
+static dlist_head resolves = DLIST_STATIC_INIT(resolves);
+
+static void backend_idle_result(Backend *backend);
 
 Backend *backend_host(const char *host) {
     dlist_mutable_iter iter;
@@ -24,6 +30,13 @@ Backend *backend_state(state_t state) {
     return NULL;
 }
 
+int backend_count(void) {
+    int count = 0;
+    dlist_iter iter;
+    dlist_foreach(iter, &backends) count++;
+    return count;
+}
+
 int backend_nevents(void) {
     int nevents = 0;
     dlist_mutable_iter iter;
@@ -39,13 +52,15 @@ int backend_nevents(void) {
 static void backend_connected(Backend *backend) {
     elog(DEBUG1, "%s:%s", backend->host, init_state2char(backend->state));
     backend->attempt = 0;
+    backend_idle(backend);
     init_set_host(backend->host, backend->state);
     RecoveryInProgress() ? standby_connected(backend) : primary_connected(backend);
     init_reload();
 }
 
 static void backend_fail(Backend *backend) {
-    if (backend->attempt++ < init_attempt) return;
+    journal_write(journal_fail, backend->host, backend->state, backend->attempt, NULL);
+    if (backend->attempt++ < init_attempt && !standby_switchover(backend)) return;
     elog(DEBUG1, "%s:%s", backend->host, init_state2char(backend->state));
     init_set_host(backend->host, state_unknown);
     RecoveryInProgress() ? standby_failed(backend) : primary_failed(backend);
@@ -75,10 +90,38 @@ static void backend_reset_socket(Backend *backend) {
     backend_connect_or_reset_socket(backend, PQresetPoll);
 }
 
+static Resolve *backend_resolve_find(const char *host) {
+    dlist_iter iter;
+    dlist_foreach(iter, &resolves) {
+        Resolve *resolve = dlist_container(Resolve, node, iter.cur);
+        if (!strcmp(host, resolve->host)) return resolve;
+    }
+    return NULL;
+}
+
+static Resolve *backend_resolve(const char *host) {
+    Resolve *resolve = backend_resolve_find(host);
+    TimestampTz now = GetCurrentTimestamp();
+    if (!resolve) {
+        resolve = MemoryContextAllocZero(backend_context, sizeof(*resolve));
+        resolve->host = MemoryContextStrdup(backend_context, host);
+        dlist_push_head(&resolves, &resolve->node);
+    }
+    if (resolve->time && !TimestampDifferenceExceeds(resolve->time, now, init_resolve_ttl * 1000)) return resolve;
+    if ((resolve->pending = helper_resolve(host))) resolve->time = now;
+    return resolve;
+}
+
 static void backend_connect_or_reset(Backend *backend) {
-    const char *keywords[] = {"host", "port", "user", "dbname", "application_name", "target_session_attrs", NULL};
-    const char *values[] = {backend->host, pgport ? pgport : DEF_PGPORT_STR, "postgres", "postgres", hostname, backend->state <= state_primary ? "read-write" : "any", NULL};
+    Resolve *resolve = backend_resolve(backend->host);
+    const char *keywords[] = {"host", "hostaddr", "port", "user", "dbname", "application_name", "target_session_attrs", NULL};
+    const char *values[] = {backend->host, resolve->hostaddr, pgport ? pgport : DEF_PGPORT_STR, "postgres", "postgres", hostname, backend->state <= state_primary ? "read-write" : "any", NULL};
     StaticAssertStmt(countof(keywords) == countof(values), "countof(keywords) == countof(values)");
+    if (resolve->pending && !resolve->hostaddr) { elog(DEBUG1, "%s:%s resolving", backend->host, init_state2char(backend->state)); return; }
+    if (resolve->resolved && !resolve->hostaddr) { elog(WARNING, "%s:%s could not resolve and %i < %i", backend->host, init_state2char(backend->state), backend->attempt, init_attempt); backend_fail(backend); return; }
+    if (backend->conn && (backend->hostaddr ? !resolve->hostaddr || strcmp(backend->hostaddr, resolve->hostaddr) : resolve->hostaddr != NULL)) { PQfinish(backend->conn); backend->conn = NULL; }
+    if (backend->hostaddr) pfree(backend->hostaddr);
+    backend->hostaddr = resolve->hostaddr ? MemoryContextStrdup(backend_context, resolve->hostaddr) : NULL;
     if (!backend->conn) {
         if (!(backend->conn = PQconnectStartParams(keywords, values, false))) { elog(WARNING, "%s:%s !PQconnectStartParams and %i < %i and %s", backend->host, init_state2char(backend->state), backend->attempt, init_attempt, PQerrorMessageMy(backend->conn)); backend_fail(backend); return; }
         backend->socket = backend_create_socket;
@@ -92,6 +135,26 @@ static void backend_connect_or_reset(Backend *backend) {
     backend->event = WL_SOCKET_MASK;
 }
 
+void backend_resolved(const char *host, const char *hostaddr) {
+    Backend *backend;
+    Resolve *resolve = backend_resolve_find(host);
+    if (!resolve) return;
+    resolve->pending = false;
+    resolve->time = GetCurrentTimestamp();
+    if (!hostaddr && resolve->hostaddr) { elog(WARNING, "%s: could not resolve, keep %s", host, resolve->hostaddr); return; }
+    resolve->resolved = true;
+    if (hostaddr && resolve->hostaddr && !strcmp(hostaddr, resolve->hostaddr)) return;
+    elog(LOG, "%s: hostaddr = %s", host, hostaddr ? hostaddr : "(null)");
+    if (resolve->hostaddr) pfree(resolve->hostaddr);
+    resolve->hostaddr = hostaddr ? MemoryContextStrdup(backend_context, hostaddr) : NULL;
+    if ((backend = backend_host(host)) && PQstatus(backend->conn) == CONNECTION_BAD) backend_connect_or_reset(backend);
+}
+
+void backend_reset(Backend *backend) {
+    journal_write(journal_fail, backend->host, backend->state, backend->attempt, "reset");
+    backend_connect_or_reset(backend);
+}
+
 static void backend_created(Backend *backend) {
     RecoveryInProgress() ? standby_created(backend) : primary_created(backend);
 }
@@ -100,8 +163,8 @@ void backend_create(const char *host, state_t state) {
     Backend *backend;
     if (!strcmp(host, hostname)) { elog(WARNING, "backend with host \"%s\" is local!", host); return; }
     if ((backend = backend_host(host))) { elog(WARNING, "backend with host \"%s\" already exists!", host); return; }
-    backend = MemoryContextAllocZero(TopMemoryContext, sizeof(*backend));
-    backend->host = MemoryContextStrdup(TopMemoryContext, host);
+    backend = MemoryContextAllocZero(backend_context, sizeof(*backend));
+    backend->host = MemoryContextStrdup(backend_context, host);
     backend->state = state;
     dlist_push_head(&backends, &backend->node);
     backend_connect_or_reset(backend);
@@ -131,10 +194,20 @@ void backend_finish(Backend *backend) {
     dlist_delete(&backend->node);
     backend_finished(backend);
     PQfinish(backend->conn);
+    init_set_peer(backend->host, -1, 0);
+    if (backend->hostaddr) pfree(backend->hostaddr);
     pfree(backend->host);
     pfree(backend);
 }
 
+void backend_foreach(void (*callback) (Backend *backend)) {
+    dlist_mutable_iter iter;
+    dlist_foreach_modify(iter, &backends) {
+        Backend *backend = dlist_container(Backend, node, iter.cur);
+        callback(backend);
+    }
+}
+
 void backend_fini(void) {
     dlist_mutable_iter iter;
     dlist_foreach_modify(iter, &backends) {
@@ -145,12 +218,18 @@ void backend_fini(void) {
 }
 
 static void backend_idle_result(Backend *backend) {
+    bool notified = false;
     for (PGresult *result; PQstatus(backend->conn) == CONNECTION_OK && (result = PQgetResult(backend->conn)); ) {
         switch (PQresultStatus(result)) {
             default: elog(DEBUG1, "%s:%s PQresultStatus = %s and %s", backend->host, init_state2char(backend->state), PQresStatus(PQresultStatus(result)), PQresultErrorMessageMy(result)); break;
         }
         PQclear(result);
     }
+    for (PGnotify *notify; PQstatus(backend->conn) == CONNECTION_OK && (notify = PQnotifies(backend->conn)); PQfreemem(notify)) {
+        elog(DEBUG1, "%s:%s %s = %s", backend->host, init_state2char(backend->state), notify->relname, notify->extra);
+        notified = true;
+    }
+    if (notified && RecoveryInProgress()) standby_notified(backend);
 }
 
 void backend_idle(Backend *backend) {
@@ -158,7 +237,12 @@ void backend_idle(Backend *backend) {
     backend->socket = backend_idle_result;
 }
 
+bool backend_idling(Backend *backend) {
+    return backend->socket == backend_idle_result;
+}
+
 void backend_init(void) {
+    backend_context = AllocSetContextCreate(TopMemoryContext, "Backend", ALLOCSET_DEFAULT_SIZES);
     pgport = getenv("PGPORT");
     init_backend();
     RecoveryInProgress() ? standby_init() : primary_init();
@@ -171,6 +255,42 @@ static void backend_updated(Backend *backend) {
     init_reload();
 }
 
+static void backend_ping_result(Backend *backend) {
+    double sample;
+    instr_time now;
+    for (PGresult *result; PQstatus(backend->conn) == CONNECTION_OK && (result = PQgetResult(backend->conn)); ) {
+        switch (PQresultStatus(result)) {
+            case PGRES_TUPLES_OK: break;
+            default: elog(WARNING, "%s:%s PQresultStatus = %s and %s", backend->host, init_state2char(backend->state), PQresStatus(PQresultStatus(result)), PQresultErrorMessageMy(result)); break;
+        }
+        PQclear(result);
+    }
+    INSTR_TIME_SET_CURRENT(now);
+    INSTR_TIME_SUBTRACT(now, backend->ping);
+    sample = INSTR_TIME_GET_MILLISEC(now);
+    if (!backend->rtt) { backend->rtt = sample; backend->jitter = sample / 2; }
+    else { backend->jitter = 0.75 * backend->jitter + 0.25 * fabs(backend->rtt - sample); backend->rtt = 0.875 * backend->rtt + 0.125 * sample; }
+    elog(DEBUG1, "%s:%s rtt = %.3f ms, jitter = %.3f ms", backend->host, init_state2char(backend->state), backend->rtt, backend->jitter);
+    init_set_peer(backend->host, backend->rtt, backend->jitter);
+    backend_idle(backend);
+    backend_idle_result(backend);
+}
+
+static void backend_ping(Backend *backend) {
+    if (!PQsendQuery(backend->conn, SQL(SELECT 1))) { elog(WARNING, "%s:%s !PQsendQuery and %s", backend->host, init_state2char(backend->state), PQerrorMessageMy(backend->conn)); return; }
+    INSTR_TIME_SET_CURRENT(backend->ping);
+    backend->socket = backend_ping_result;
+    backend->event = WL_SOCKET_READABLE;
+}
+
+bool backend_pinging(Backend *backend) {
+    return backend->socket == backend_ping_result;
+}
+
+static long backend_rto(Backend *backend) {
+    return Max(init_timeout, (long)(backend->rtt + 4 * backend->jitter));
+}
+
 void backend_readable(Backend *backend) {
     if (PQstatus(backend->conn) == CONNECTION_OK && !PQconsumeInput(backend->conn)) return;
     backend->socket(backend);
@@ -182,13 +302,33 @@ void backend_result(const char *host, state_t state) {
     backend ? backend_update(backend, state) : backend_create(host, state);
 }
 
+void backend_topology(StringInfo buf) {
+    dlist_iter iter;
+    dlist_foreach(iter, &backends) {
+        Backend *backend = dlist_container(Backend, node, iter.cur);
+        appendStringInfo(buf, ",%s=%s", backend->host, init_state2char(backend->state));
+    }
+}
+
 void backend_timeout(void) {
     dlist_mutable_iter iter;
     dlist_foreach_modify(iter, &backends) {
         Backend *backend = dlist_container(Backend, node, iter.cur);
         if (PQstatus(backend->conn) == CONNECTION_BAD) backend_connect_or_reset(backend);
     }
-    RecoveryInProgress() ? standby_timeout() : primary_timeout();
+    if (!standby_promoting()) RecoveryInProgress() ? standby_timeout() : primary_timeout();
+    dlist_foreach_modify(iter, &backends) {
+        Backend *backend = dlist_container(Backend, node, iter.cur);
+        instr_time now;
+        if (PQstatus(backend->conn) != CONNECTION_OK) continue;
+        if (backend->socket == backend_idle_result) { backend_ping(backend); continue; }
+        if (!backend_pinging(backend)) continue;
+        INSTR_TIME_SET_CURRENT(now);
+        INSTR_TIME_SUBTRACT(now, backend->ping);
+        if ((long)INSTR_TIME_GET_MILLISEC(now) <= init_attempt * backend_rto(backend)) continue;
+        elog(WARNING, "%s:%s no ping result in %li ms", backend->host, init_state2char(backend->state), (long)INSTR_TIME_GET_MILLISEC(now));
+        backend_reset(backend);
+    }
     init_reload();
 }
 
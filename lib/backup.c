@@ -0,0 +1,133 @@
+#include "lib.h"
+
+extern int init_backup;
+extern int init_backup_keep;
+extern MemoryContext save_context;
+static char backup_name[MAXPGPATH];
+static const char *backup_arclog = NULL;
+static pid_t backup_catalog_pid = 0;
+static pid_t backup_pid = 0;
+static TimestampTz backup_time = 0;
+
+static void backup_write(const char *name, const char *data) {
+    char filename[MAXPGPATH];
+    FILE *file;
+    snprintf(filename, sizeof(filename), "%s/base/%s.tmp/%s", backup_arclog, backup_name, name);
+    if (!(file = AllocateFile(filename, "w"))) { ereport(WARNING, (errcode_for_file_access(), errmsg("could not create file \"%s\": %m", filename))); return; }
+    if (fwrite(data, strlen(data), 1, file) != 1) ereport(WARNING, (errcode_for_file_access(), errmsg("could not write file \"%s\": %m", filename)));
+    FreeFile(file);
+}
+
+static void backup_prune(void) {
+    char base[MAXPGPATH];
+    for (;;) {
+        char oldest[MAXPGPATH] = "";
+        DIR *dir;
+        int count = 0;
+        struct dirent *de;
+        snprintf(base, sizeof(base), "%s/base", backup_arclog);
+        if (!(dir = AllocateDir(base))) return;
+        while ((de = ReadDir(dir, base))) {
+            if (de->d_name[0] == '.' || strchr(de->d_name, '.')) continue;
+            count++;
+            if (oldest[0] == '\0' || strcmp(de->d_name, oldest) < 0) strlcpy(oldest, de->d_name, sizeof(oldest));
+        }
+        FreeDir(dir);
+        if (count <= init_backup_keep) return;
+        snprintf(base, sizeof(base), "%s/base/%s", backup_arclog, oldest);
+        elog(LOG, "remove base backup \"%s\"", base);
+        if (!rmtree(base, true)) return;
+    }
+}
+
+static void backup_newest(void) {
+    char base[MAXPGPATH];
+    DIR *dir;
+    long newest = 0;
+    struct dirent *de;
+    snprintf(base, sizeof(base), "%s/base", backup_arclog);
+    if (!(dir = AllocateDir(base))) return;
+    while ((de = ReadDir(dir, base))) {
+        if (de->d_name[0] == '.' || strchr(de->d_name, '.')) continue;
+        newest = Max(newest, strtol(de->d_name, NULL, 10));
+    }
+    FreeDir(dir);
+    if (newest) backup_time = time_t_to_timestamptz(newest);
+}
+
+static void backup_stop(bool ok) {
+    char filename[MAXPGPATH];
+    char tmp[MAXPGPATH];
+#if PG_VERSION_NUM >= 150000
+    static char *command = SQL(SELECT labelfile, spcmapfile FROM pg_backup_stop(false));
+#else
+    static char *command = SQL(SELECT labelfile, spcmapfile FROM pg_stop_backup(false, false));
+#endif
+    SPI_connect_my(command);
+    SPI_execute_with_args_my(command, 0, NULL, NULL, NULL, SPI_OK_SELECT, false);
+    if (ok && SPI_processed == 1) {
+        char *labelfile = TextDatumGetCStringMy(save_context, SPI_getbinval_my(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, "labelfile", false));
+        char *spcmapfile = TextDatumGetCStringMy(save_context, SPI_getbinval_my(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, "spcmapfile", true));
+        backup_write("backup_label", labelfile);
+        if (spcmapfile && spcmapfile[0] != '\0') backup_write("tablespace_map", spcmapfile);
+    }
+    SPI_commit_my();
+    SPI_finish_my();
+    snprintf(tmp, sizeof(tmp), "%s/base/%s.tmp", backup_arclog, backup_name);
+    snprintf(filename, sizeof(filename), "%s/base/%s", backup_arclog, backup_name);
+    if (!ok) { elog(WARNING, "base backup \"%s\" failed", filename); rmtree(tmp, true); return; }
+    if (rename(tmp, filename)) { ereport(WARNING, (errcode_for_file_access(), errmsg("could not rename \"%s\" to \"%s\": %m", tmp, filename))); rmtree(tmp, true); return; }
+    elog(LOG, "base backup \"%s\" done", filename);
+    backup_prune();
+    if (backup_catalog_pid) return;
+    switch ((backup_catalog_pid = fork())) {
+        case -1: ereport(WARNING, (errmsg("could not fork: %m"))); backup_catalog_pid = 0; break;
+        case 0: execl("/bin/sh", "sh", "-c", "pg_save prune && pg_save verify", (char *)NULL); _exit(127);
+        default: break;
+    }
+}
+
+static void backup_start(void) {
+    char filename[MAXPGPATH];
+    StringInfoData buf;
+#if PG_VERSION_NUM >= 150000
+    static char *command = SQL(SELECT pg_backup_start('pg_save', true));
+#else
+    static char *command = SQL(SELECT pg_start_backup('pg_save', true, false));
+#endif
+    backup_time = GetCurrentTimestamp();
+    snprintf(backup_name, sizeof(backup_name), "%010ld", (long)timestamptz_to_time_t(backup_time));
+    snprintf(filename, sizeof(filename), "%s/base/%s.tmp", backup_arclog, backup_name);
+    if (pg_mkdir_p(filename, S_IRWXU) == -1) { ereport(WARNING, (errcode_for_file_access(), errmsg("could not create directory \"%s\": %m", filename))); return; }
+    SPI_connect_my(command);
+    SPI_execute_with_args_my(command, 0, NULL, NULL, NULL, SPI_OK_SELECT, true);
+    SPI_finish_my();
+    initStringInfoMy(save_context, &buf);
+    appendStringInfo(&buf, "tar --create --gzip --file=\"%s/base.tar.gz\" --exclude=\"./%s\" --exclude=\"./pg_wal/*\" --exclude=\"./pg_replslot/*\" --exclude=\"./pg_stat_tmp/*\" --exclude=\"./postmaster.pid\" --exclude=\"./postmaster.opts\" --exclude=\"./pg_save.history\" --exclude=\"./pg_save.journal\" --exclude=\"./pg_save.resync\" --exclude=\"./standby.signal\" --exclude=\"./backup_label\" --exclude=\"./tablespace_map\" --warning=no-file-changed --warning=no-file-removed --ignore-failed-read .", filename, backup_arclog);
+    elog(LOG, "%s", buf.data);
+    switch ((backup_pid = fork())) {
+        case -1: ereport(WARNING, (errmsg("could not fork: %m"))); backup_pid = 0; backup_stop(false); break;
+        case 0: execl("/bin/sh", "sh", "-c", buf.data, (char *)NULL); _exit(127);
+        default: break;
+    }
+    pfree(buf.data);
+}
+
+void backup_timeout(void) {
+    int status;
+    if (!backup_arclog) backup_arclog = getenv("ARCLOG");
+    if (!backup_arclog || !init_backup || RecoveryInProgress()) return;
+    if (backup_catalog_pid) switch (waitpid(backup_catalog_pid, &status, WNOHANG)) {
+        case -1: backup_catalog_pid = 0; break;
+        case 0: break;
+        default: if (!WIFEXITED(status) || WEXITSTATUS(status)) elog(WARNING, "archive prune or verify failed"); backup_catalog_pid = 0; break;
+    }
+    if (backup_pid) switch (waitpid(backup_pid, &status, WNOHANG)) {
+        case -1: ereport(WARNING, (errmsg("waitpid(%i) and %m", backup_pid))); backup_pid = 0; backup_stop(false); return;
+        case 0: return;
+        default: backup_pid = 0; backup_stop(WIFEXITED(status) && WEXITSTATUS(status) <= 1); return;
+    }
+    if (!backup_time) backup_newest();
+    if (backup_time && !TimestampDifferenceExceeds(backup_time, GetCurrentTimestamp(), init_backup * 1000)) return;
+    backup_start();
+}
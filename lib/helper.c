@@ -0,0 +1,240 @@
+#include "lib.h"
+
+extern char *hostname;
+extern int init_timeout;
+static BackgroundWorkerHandle *helper_handle = NULL;
+static BackgroundWorkerHandle *helper_resolver_handle = NULL;
+static dsm_segment *helper_seg = NULL;
+static Helper *helper = NULL;
+static shm_mq_handle *helper_mqh = NULL;
+static shm_mq_handle *helper_reply_mqh = NULL;
+static shm_mq_handle *helper_resolve_mqh = NULL;
+static uint64 helper_sent = 0;
+
+static shm_mq_result helper_message(shm_mq_handle *mqh, helper_t type, int value, const char *name, const char *data, bool nowait) {
+    char buf[sizeof(HelperMessage) + NAMEDATALEN + MAXPGPATH];
+    HelperMessage *message = (HelperMessage *)buf;
+    Size name_len = name ? strlen(name) + 1 : 0;
+    Size data_len = data ? strlen(data) + 1 : 1;
+    if (offsetof(HelperMessage, data) + name_len + data_len > sizeof(buf)) return SHM_MQ_WOULD_BLOCK;
+    message->type = type;
+    message->value = value;
+    message->name_len = name_len;
+    if (name_len) memcpy(message->data, name, name_len);
+    memcpy(message->data + name_len, data ? data : "", data_len);
+#if PG_VERSION_NUM >= 150000
+    return shm_mq_send(mqh, offsetof(HelperMessage, data) + name_len + data_len, message, nowait, true);
+#else
+    return shm_mq_send(mqh, offsetof(HelperMessage, data) + name_len + data_len, message, nowait);
+#endif
+}
+
+static bool helper_send(helper_t type, int value, const char *name, const char *data) {
+    if (!helper_mqh) return false;
+    switch (helper_message(helper_mqh, type, value, name, data, false)) {
+        case SHM_MQ_SUCCESS: break;
+        case SHM_MQ_WOULD_BLOCK: return false;
+        default: elog(WARNING, "helper detached"); helper_fini(); return false;
+    }
+    helper_sent++;
+    return true;
+}
+
+bool helper_checkpoint(int flags) {
+    return helper_send(helper_checkpoint_type, flags, NULL, NULL);
+}
+
+void helper_fini(void) {
+    if (helper_mqh) shm_mq_detach(helper_mqh);
+    helper_mqh = NULL;
+    if (helper_reply_mqh) shm_mq_detach(helper_reply_mqh);
+    helper_reply_mqh = NULL;
+    if (helper_resolve_mqh) shm_mq_detach(helper_resolve_mqh);
+    helper_resolve_mqh = NULL;
+    if (helper_handle) TerminateBackgroundWorker(helper_handle);
+    helper_handle = NULL;
+    if (helper_resolver_handle) TerminateBackgroundWorker(helper_resolver_handle);
+    helper_resolver_handle = NULL;
+    if (helper_seg) dsm_detach(helper_seg);
+    helper_seg = NULL;
+    helper = NULL;
+}
+
+void helper_flush(void) {
+    for (long timeout = init_timeout; helper && timeout > 0; timeout -= 10) {
+        pid_t pid;
+        uint64 done;
+        if (GetBackgroundWorkerPid(helper_handle, &pid) != BGWH_STARTED) { elog(WARNING, "helper is not running"); helper_fini(); return; }
+        SpinLockAcquire(&helper->mutex);
+        done = helper->done;
+        SpinLockRelease(&helper->mutex);
+        if (done >= helper_sent) return;
+#if PG_VERSION_NUM >= 100000
+        if (WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, 10, PG_WAIT_EXTENSION) & WL_POSTMASTER_DEATH) return;
+#else
+        if (WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, 10) & WL_POSTMASTER_DEATH) return;
+#endif
+        ResetLatch(MyLatch);
+    }
+    if (helper) elog(WARNING, "helper did not flush");
+}
+
+static bool helper_worker(const char *function, const char *name, int flags, BackgroundWorkerHandle **handle) {
+    BackgroundWorker worker = {0};
+    pid_t pid;
+    size_t len;
+    if ((len = strlcpy(worker.bgw_function_name, function, sizeof(worker.bgw_function_name))) >= sizeof(worker.bgw_function_name)) ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY), errmsg("strlcpy %li >= %li", len, sizeof(worker.bgw_function_name))));
+    if ((len = strlcpy(worker.bgw_library_name, "pg_save", sizeof(worker.bgw_library_name))) >= sizeof(worker.bgw_library_name)) ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY), errmsg("strlcpy %li >= %li", len, sizeof(worker.bgw_library_name))));
+    if ((len = snprintf(worker.bgw_name, sizeof(worker.bgw_name) - 1, "postgres postgres pg_save %s %s", name, hostname)) >= sizeof(worker.bgw_name) - 1) ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY), errmsg("snprintf %li >= %li", len, sizeof(worker.bgw_name) - 1)));
+#if PG_VERSION_NUM >= 110000
+    if ((len = strlcpy(worker.bgw_type, worker.bgw_name, sizeof(worker.bgw_type))) >= sizeof(worker.bgw_type)) ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY), errmsg("strlcpy %li >= %li", len, sizeof(worker.bgw_type))));
+#endif
+    worker.bgw_flags = flags;
+    worker.bgw_main_arg = UInt32GetDatum(dsm_segment_handle(helper_seg));
+    worker.bgw_notify_pid = MyProcPid;
+    worker.bgw_restart_time = BGW_NEVER_RESTART;
+    worker.bgw_start_time = BgWorkerStart_ConsistentState;
+    if (!RegisterDynamicBackgroundWorker(&worker, handle)) { elog(WARNING, "!RegisterDynamicBackgroundWorker"); return false; }
+    if (WaitForBackgroundWorkerStartup(*handle, &pid) != BGWH_STARTED) { elog(WARNING, "!WaitForBackgroundWorkerStartup"); return false; }
+    elog(DEBUG1, "%s pid = %i", name, pid);
+    return true;
+}
+
+void helper_init(void) {
+    shm_mq *mq;
+    shm_mq *reply;
+    shm_mq *resolve;
+    helper_seg = dsm_create(MAXALIGN(sizeof(*helper)) + 3 * HELPER_QUEUE_SIZE, 0);
+    dsm_pin_mapping(helper_seg);
+    helper = dsm_segment_address(helper_seg);
+    SpinLockInit(&helper->mutex);
+    helper->done = 0;
+    mq = shm_mq_create((char *)helper + MAXALIGN(sizeof(*helper)), HELPER_QUEUE_SIZE);
+    shm_mq_set_sender(mq, MyProc);
+    reply = shm_mq_create((char *)helper + MAXALIGN(sizeof(*helper)) + HELPER_QUEUE_SIZE, HELPER_QUEUE_SIZE);
+    shm_mq_set_receiver(reply, MyProc);
+    resolve = shm_mq_create((char *)helper + MAXALIGN(sizeof(*helper)) + 2 * HELPER_QUEUE_SIZE, HELPER_QUEUE_SIZE);
+    shm_mq_set_sender(resolve, MyProc);
+    if (!helper_worker("save_helper", "helper", BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION, &helper_handle)) { helper_fini(); return; }
+    helper_mqh = shm_mq_attach(mq, helper_seg, helper_handle);
+    if (!helper_worker("save_resolver", "resolver", BGWORKER_SHMEM_ACCESS, &helper_resolver_handle)) { helper_fini(); return; }
+    helper_reply_mqh = shm_mq_attach(reply, helper_seg, helper_resolver_handle);
+    helper_resolve_mqh = shm_mq_attach(resolve, helper_seg, helper_resolver_handle);
+}
+
+void helper_receive(void) {
+    Size nbytes;
+    void *data;
+    shm_mq_result result;
+    while (helper_reply_mqh && (result = shm_mq_receive(helper_reply_mqh, &nbytes, &data, true)) != SHM_MQ_WOULD_BLOCK) {
+        HelperMessage *message = data;
+        if (result != SHM_MQ_SUCCESS) { elog(WARNING, "helper detached"); helper_fini(); return; }
+        switch (message->type) {
+            case helper_resolve_type: backend_resolved(message->data, message->data[message->name_len] != '\0' ? message->data + message->name_len : NULL); break;
+            default: elog(WARNING, "unknown helper reply type = %i", message->type); break;
+        }
+    }
+}
+
+bool helper_reload(void) {
+    return helper_send(helper_reload_type, SIGHUP, NULL, NULL);
+}
+
+bool helper_resolve(const char *host) {
+    if (!helper_resolve_mqh) return false;
+    switch (helper_message(helper_resolve_mqh, helper_resolve_type, 0, host, NULL, true)) {
+        case SHM_MQ_SUCCESS: return true;
+        case SHM_MQ_WOULD_BLOCK: return false;
+        default: elog(WARNING, "resolver detached"); helper_fini(); return false;
+    }
+}
+
+static void helper_resolve_process(const char *host) {
+    char hostaddr[NI_MAXHOST];
+    int rc;
+    struct addrinfo hints = {0};
+    struct addrinfo *res;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((rc = getaddrinfo(host, NULL, &hints, &res))) { elog(WARNING, "getaddrinfo(\"%s\") and %s", host, gai_strerror(rc)); hostaddr[0] = '\0'; }
+    else {
+        if ((rc = getnameinfo(res->ai_addr, res->ai_addrlen, hostaddr, sizeof(hostaddr), NULL, 0, NI_NUMERICHOST))) { elog(WARNING, "getnameinfo(\"%s\") and %s", host, gai_strerror(rc)); hostaddr[0] = '\0'; }
+        freeaddrinfo(res);
+    }
+    if (helper_message(helper_reply_mqh, helper_resolve_type, 0, host, hostaddr, true) != SHM_MQ_SUCCESS) elog(WARNING, "could not reply resolve \"%s\"", host);
+}
+
+bool helper_system(const char *name, const char *new) {
+    return helper_send(helper_system_type, 0, name, new);
+}
+
+static void helper_process(HelperMessage *message) {
+    const char *name = message->name_len ? message->data : NULL;
+    const char *data = message->data[message->name_len] != '\0' ? message->data + message->name_len : NULL;
+    switch (message->type) {
+        case helper_checkpoint_type: RequestCheckpoint(message->value); break;
+        case helper_reload_type: if (kill(PostmasterPid, message->value)) elog(WARNING, "kill(%i, %i)", PostmasterPid, message->value); break;
+        case helper_system_type: StartTransactionCommand(); init_alter_system(name, data); CommitTransactionCommand(); break;
+        default: elog(WARNING, "unknown helper message type = %i", message->type); break;
+    }
+}
+
+void save_helper(Datum main_arg) {
+    dsm_segment *seg;
+    Helper *shared;
+    shm_mq *mq;
+    shm_mq_handle *mqh;
+    pqsignal(SIGHUP, SignalHandlerForConfigReload);
+    pqsignal(SIGTERM, die);
+    BackgroundWorkerUnblockSignals();
+#if PG_VERSION_NUM >= 110000
+    BackgroundWorkerInitializeConnection("postgres", "postgres", 0);
+#else
+    BackgroundWorkerInitializeConnection("postgres", "postgres");
+#endif
+    pgstat_report_appname(hostname);
+    if (!(seg = dsm_attach(DatumGetUInt32(main_arg)))) ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE), errmsg("could not map dynamic shared memory segment")));
+    shared = dsm_segment_address(seg);
+    mq = (shm_mq *)((char *)shared + MAXALIGN(sizeof(*shared)));
+    shm_mq_set_receiver(mq, MyProc);
+    mqh = shm_mq_attach(mq, seg, NULL);
+    for (;;) {
+        Size nbytes;
+        void *data;
+        if (ConfigReloadPending) { ConfigReloadPending = false; ProcessConfigFile(PGC_SIGHUP); }
+        if (shm_mq_receive(mqh, &nbytes, &data, false) != SHM_MQ_SUCCESS) break;
+        helper_process(data);
+        SpinLockAcquire(&shared->mutex);
+        shared->done++;
+        SpinLockRelease(&shared->mutex);
+        CHECK_FOR_INTERRUPTS();
+    }
+    dsm_detach(seg);
+}
+
+void save_resolver(Datum main_arg) {
+    dsm_segment *seg;
+    Helper *shared;
+    shm_mq *reply;
+    shm_mq *resolve;
+    shm_mq_handle *mqh;
+    pqsignal(SIGTERM, die);
+    BackgroundWorkerUnblockSignals();
+    if (!(seg = dsm_attach(DatumGetUInt32(main_arg)))) ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE), errmsg("could not map dynamic shared memory segment")));
+    shared = dsm_segment_address(seg);
+    reply = (shm_mq *)((char *)shared + MAXALIGN(sizeof(*shared)) + HELPER_QUEUE_SIZE);
+    shm_mq_set_sender(reply, MyProc);
+    helper_reply_mqh = shm_mq_attach(reply, seg, NULL);
+    resolve = (shm_mq *)((char *)shared + MAXALIGN(sizeof(*shared)) + 2 * HELPER_QUEUE_SIZE);
+    shm_mq_set_receiver(resolve, MyProc);
+    mqh = shm_mq_attach(resolve, seg, NULL);
+    for (;;) {
+        Size nbytes;
+        HelperMessage *message;
+        if (shm_mq_receive(mqh, &nbytes, (void **)&message, false) != SHM_MQ_SUCCESS) break;
+        if (message->type == helper_resolve_type && message->name_len) helper_resolve_process(message->data);
+        else elog(WARNING, "unknown resolver message type = %i", message->type);
+        CHECK_FOR_INTERRUPTS();
+    }
+    dsm_detach(seg);
+}
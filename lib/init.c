@@ -4,13 +4,38 @@ PG_MODULE_MAGIC;
 
 char *hostname;
 int init_attempt;
+int init_backup;
+int init_backup_keep;
+int init_cascade_lag;
+int init_cluster_size;
+int init_commit_latency;
+int init_journal;
+int init_kill_limit;
+int init_lease;
+int init_prewarm;
+int init_prewarm_refresh;
+int init_resolve_ttl;
 int init_timeout;
+char *synchronous_standby_names;
 state_t init_state = state_unknown;
+static bool init_dirty = false;
+static bool init_history = false;
 static bool init_sighup = false;
 static char *init_hostname;
-static char *synchronous_standby_names;
+static int init_kills = 0;
 static int init_restart;
-#define XX(name) static char *init_##name;
+static int init_starts = 0;
+static int8 init_state_hash[32];
+static uint32 init_state_seed;
+static TimestampTz init_exit_time = 0;
+static TimestampTz init_kill_time = 0;
+static TimestampTz init_start_time = 0;
+Shmem *init_shmem = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#define XX(name) static char *init_##name = NULL;
 STATE_MAP(XX)
 #undef XX
 
@@ -34,13 +59,58 @@ const char *init_state2char(state_t state) {
     ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("unknown state = %i", state)));
 }
 
+char *init_archiver(void) {
+    char host[NAMEDATALEN];
+    SpinLockAcquire(&init_shmem->mutex);
+    strlcpy(host, init_shmem->archiver, sizeof(host));
+    SpinLockRelease(&init_shmem->mutex);
+    return host[0] != '\0' ? pstrdup(host) : NULL;
+}
+
+char *init_switchover(void) {
+    char target[NAMEDATALEN];
+    TimestampTz time;
+    SpinLockAcquire(&init_shmem->mutex);
+    strlcpy(target, init_shmem->switchover, sizeof(target));
+    time = init_shmem->switchover_time;
+    SpinLockRelease(&init_shmem->mutex);
+    if (target[0] == '\0') return NULL;
+    if (TimestampDifferenceExceeds(time, GetCurrentTimestamp(), 2 * init_attempt * init_timeout)) return NULL;
+    return pstrdup(target);
+}
+
+uint32 init_hash(const char *str, uint32 seed) {
+    for (; *str; str++) seed = (seed ^ (unsigned char)*str) * 16777619;
+    return seed;
+}
+
 state_t init_char2state(const char *state) {
-#define XX(name) if (!strcmp(state, #name)) return state_##name;
-    STATE_MAP(XX)
-#undef XX
+    int8 hash = init_state_hash[init_hash(state, init_state_seed) % countof(init_state_hash)];
+    if (hash >= 0 && !strcmp(state, init_state2char(hash))) return hash;
     ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("unknown state = %s", state)));
 }
 
+static void init_char2state_init(void) {
+    for (init_state_seed = 1; init_state_seed < PG_UINT16_MAX; init_state_seed++) {
+        bool perfect = true;
+        MemSet(init_state_hash, -1, sizeof(init_state_hash));
+#define XX(name) if (perfect && init_state_hash[init_hash(#name, init_state_seed) % countof(init_state_hash)] >= 0) perfect = false; else init_state_hash[init_hash(#name, init_state_seed) % countof(init_state_hash)] = state_##name;
+        STATE_MAP(XX)
+#undef XX
+        if (perfect) { elog(DEBUG1, "init_state_seed = %u", init_state_seed); return; }
+    }
+    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("can not generate state hash")));
+}
+
+const char *init_state2host(state_t state) {
+    switch (state) {
+#define XX(name) case state_##name: return init_##name;
+        STATE_MAP(XX)
+#undef XX
+    }
+    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("unknown state = %i", state)));
+}
+
 state_t init_host(const char *host) {
 #define XX(name) if (init_##name && !strcmp(host, init_##name)) return state_##name;
     STATE_MAP(XX)
@@ -56,7 +126,18 @@ void init_backend(void) {
 
 void init_debug(void) {
     elog(DEBUG1, "attempt = %i", init_attempt);
+    elog(DEBUG1, "backup = %i", init_backup);
+    elog(DEBUG1, "backup_keep = %i", init_backup_keep);
+    elog(DEBUG1, "cascade_lag = %i", init_cascade_lag);
+    elog(DEBUG1, "CLUSTER_SIZE = %i", init_cluster_size);
+    elog(DEBUG1, "commit_latency = %i", init_commit_latency);
     elog(DEBUG1, "HOSTNAME = '%s'", hostname);
+    elog(DEBUG1, "journal = %i", init_journal);
+    elog(DEBUG1, "kill_limit = %i", init_kill_limit);
+    elog(DEBUG1, "lease = %i", init_lease);
+    elog(DEBUG1, "prewarm = %i", init_prewarm);
+    elog(DEBUG1, "prewarm_refresh = %i", init_prewarm_refresh);
+    elog(DEBUG1, "resolve_ttl = %i", init_resolve_ttl);
     elog(DEBUG1, "restart = %i", init_restart);
     elog(DEBUG1, "state = '%s'", init_state2char(init_state));
     elog(DEBUG1, "timeout = %i", init_timeout);
@@ -70,28 +151,167 @@ void init_debug(void) {
     if (SyncRepStandbyNames && SyncRepStandbyNames[0] != '\0') elog(DEBUG1, "SyncRepStandbyNames = '%s'", SyncRepStandbyNames);
 }
 
+static long init_backoff(int count) {
+    return Min((long)init_restart << Min(count, 16), INIT_BACKOFF_MAX) * 1000L;
+}
+
+bool init_governor(void) {
+    TimestampTz now = GetCurrentTimestamp();
+    if (init_kills && TimestampDifferenceExceeds(init_kill_time, now, 2 * init_backoff(init_kills))) { elog(LOG, "forget %i kills", init_kills); init_kills = 0; init_history = true; }
+    if (init_kills >= init_kill_limit) { elog(WARNING, "circuit open after %i kills, keep running", init_kills); return false; }
+    if (init_kills && !TimestampDifferenceExceeds(init_kill_time, now, init_backoff(init_kills))) { elog(WARNING, "kill backoff %li ms after %i kills, keep running", init_backoff(init_kills), init_kills); return false; }
+    init_kill_time = now;
+    if (++init_kills >= init_kill_limit) journal_write(journal_kill, hostname, init_state, init_kills, "circuit");
+    init_history = true;
+    return true;
+}
+
+void init_kill(int sig) {
+    elog(DEBUG1, "sig = %i", sig);
+    if (sig != SIGKILL) helper_flush();
+    init_exit_time = GetCurrentTimestamp();
+    init_history = true;
+    init_write();
+    journal_write(journal_kill, hostname, init_state, sig, NULL);
+    if (kill(PostmasterPid, sig)) elog(WARNING, "kill(%i, %i)", PostmasterPid, sig);
+}
+
+static void init_set_conf(state_t state, const char *host) {
+    switch (state) {
+#define XX(name) case state_##name: if (init_##name) pfree(init_##name); init_##name = host ? MemoryContextStrdup(TopMemoryContext, host) : NULL; break;
+        STATE_MAP(XX)
+#undef XX
+    }
+    init_dirty = true;
+}
+
+static void init_migrate(void) {
+    const char *host;
+    const char *state = GetConfigOption("pg_save.state", true, false);
+    if (state && state[0] != '\0') { init_state = init_char2state(state); init_dirty = true; init_set_system("pg_save.state", NULL); }
+#define XX(name) if ((host = GetConfigOption("pg_save."#name, true, false)) && host[0] != '\0') { init_set_conf(state_##name, host); init_set_system("pg_save."#name, NULL); }
+    STATE_MAP(XX)
+#undef XX
+}
+
+static void init_read_history(void) {
+    char line[2 * NAMEDATALEN];
+    FILE *file;
+    if (!(file = AllocateFile("pg_save.history", "r"))) {
+        if (errno != ENOENT) ereport(ERROR, (errcode_for_file_access(), errmsg("could not open file \"%s\": %m", "pg_save.history")));
+        return;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        char name[NAMEDATALEN];
+        char value[NAMEDATALEN];
+        if (sscanf(line, "%63[a-z_] = '%63[^']'", name, value) != 2) continue;
+        if (!strcmp(name, "exit_time")) init_exit_time = time_t_to_timestamptz(atol(value));
+        else if (!strcmp(name, "kills")) init_kills = atoi(value);
+        else if (!strcmp(name, "kill_time")) init_kill_time = time_t_to_timestamptz(atol(value));
+        else if (!strcmp(name, "starts")) init_starts = atoi(value);
+        else if (!strcmp(name, "start_time")) init_start_time = time_t_to_timestamptz(atol(value));
+    }
+    FreeFile(file);
+}
+
+void init_read(void) {
+    bool legacy = false;
+    char line[2 * NAMEDATALEN];
+    FILE *file;
+    init_read_history();
+    if (!(file = AllocateFile("pg_save.conf", "r"))) {
+        if (errno != ENOENT) ereport(ERROR, (errcode_for_file_access(), errmsg("could not open file \"%s\": %m", "pg_save.conf")));
+        init_migrate();
+        return;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        char name[NAMEDATALEN];
+        char value[NAMEDATALEN];
+        if (sscanf(line, "%63[a-z_] = '%63[^']'", name, value) != 2) continue;
+        if (!strcmp(name, "state")) init_state = init_char2state(value);
+        else if (!strcmp(name, "archiver")) init_set_archiver(value);
+        else if (!strcmp(name, "kills") || !strcmp(name, "kill_time") || !strcmp(name, "starts") || !strcmp(name, "start_time")) legacy = true;
+        else init_set_conf(init_char2state(name), value);
+    }
+    FreeFile(file);
+    init_dirty = legacy;
+}
+
 void init_reload(void) {
+    init_write();
     if (!init_sighup) return;
-    if (kill(PostmasterPid, SIGHUP)) elog(WARNING, "kill(%i, %i)", PostmasterPid, SIGHUP);
+    journal_write(journal_reload, hostname, init_state, SIGHUP, NULL);
+    if (!helper_reload() && kill(PostmasterPid, SIGHUP)) elog(WARNING, "kill(%i, %i)", PostmasterPid, SIGHUP);
     init_sighup = false;
 }
 
+void init_started(void) {
+    long backoff;
+    TimestampTz now = GetCurrentTimestamp();
+    bool deliberate = init_start_time && init_exit_time >= init_start_time;
+    if (init_starts && TimestampDifferenceExceeds(init_start_time, now, 2 * init_backoff(init_starts))) init_starts = 0;
+    backoff = init_starts > 1 && !deliberate ? init_backoff(init_starts - 1) - (long)((now - init_start_time) / 1000) : 0;
+    if (!deliberate) init_starts++;
+    init_start_time = now;
+    init_history = true;
+    init_write();
+    journal_write(journal_start, hostname, init_state, init_starts, deliberate ? "deliberate" : NULL);
+    if (backoff <= 0) return;
+    elog(WARNING, "start %i, wait %li ms", init_starts, backoff);
+    for (; backoff > 0 && !ShutdownRequestPending; backoff -= init_timeout) {
+#if PG_VERSION_NUM >= 100000
+        if (WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, Min(backoff, init_timeout), PG_WAIT_EXTENSION) & WL_POSTMASTER_DEATH) proc_exit(1);
+#else
+        if (WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, Min(backoff, init_timeout)) & WL_POSTMASTER_DEATH) proc_exit(1);
+#endif
+        ResetLatch(MyLatch);
+        CHECK_FOR_INTERRUPTS();
+    }
+}
+
+void init_set_archiver(const char *host) {
+    bool changed;
+    SpinLockAcquire(&init_shmem->mutex);
+    if ((changed = strcmp(init_shmem->archiver, host ? host : ""))) strlcpy(init_shmem->archiver, host ? host : "", sizeof(init_shmem->archiver));
+    SpinLockRelease(&init_shmem->mutex);
+    if (!changed) return;
+    elog(LOG, "archiver = %s", host ? host : "(null)");
+    journal_write(journal_host, host, state_unknown, 0, "archiver");
+    init_dirty = true;
+}
+
 void init_set_host(const char *host, state_t state) {
-    StringInfoData buf;
     elog(DEBUG1, "host = %s, state = %s", host, init_state2char(state));
-#define XX(name) if (state != state_##name && init_##name && !strcmp(init_##name, host)) init_set_system("pg_save."#name, NULL);
+    journal_write(journal_host, host, state, 0, NULL);
+#define XX(name) if (state != state_##name && init_##name && !strcmp(init_##name, host)) init_set_conf(state_##name, NULL);
     STATE_MAP(XX)
 #undef XX
     if (state == state_unknown) return;
-    initStringInfoMy(TopMemoryContext, &buf);
-    appendStringInfo(&buf, "pg_save.%s", init_state2char(state));
-    init_set_system(buf.data, host);
-    pfree(buf.data);
+    if (!init_state2host(state) || strcmp(init_state2host(state), host)) init_set_conf(state, host);
+}
+
+void init_set_peer(const char *host, double rtt, double jitter) {
+    int slot = -1;
+    TimestampTz time = GetCurrentTimestamp();
+    SpinLockAcquire(&init_shmem->mutex);
+    for (int i = 0; i < countof(init_shmem->peers); i++) {
+        if (!strcmp(init_shmem->peers[i].host, host)) { slot = i; break; }
+        if (slot < 0 && init_shmem->peers[i].host[0] == '\0') slot = i;
+    }
+    if (slot >= 0 && rtt < 0) init_shmem->peers[slot].host[0] = '\0';
+    else if (slot >= 0) {
+        strlcpy(init_shmem->peers[slot].host, host, sizeof(init_shmem->peers[slot].host));
+        init_shmem->peers[slot].jitter = jitter;
+        init_shmem->peers[slot].rtt = rtt;
+        init_shmem->peers[slot].time = time;
+    }
+    SpinLockRelease(&init_shmem->mutex);
 }
 
 void init_set_state(state_t state) {
     elog(DEBUG1, "state = %s", init_state2char(state));
-    init_set_system("pg_save.state", init_state2char(state));
+    journal_write(journal_state, hostname, state, 0, NULL);
+    if (init_state != state) init_dirty = true;
     init_state = state;
     init_set_host(hostname, state);
     switch (state) {
@@ -106,19 +326,22 @@ void init_set_state(state_t state) {
         case state_wait_standby: break;
         default: ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("unknown init_state = %s", init_state2char(init_state)))); break;
     }
-    RequestCheckpoint(CHECKPOINT_IMMEDIATE | CHECKPOINT_WAIT | (RecoveryInProgress() ? 0 : CHECKPOINT_FORCE));
+    if (!helper_checkpoint(CHECKPOINT_IMMEDIATE | CHECKPOINT_WAIT | (RecoveryInProgress() ? 0 : CHECKPOINT_FORCE))) RequestCheckpoint(CHECKPOINT_IMMEDIATE | CHECKPOINT_WAIT | (RecoveryInProgress() ? 0 : CHECKPOINT_FORCE));
 }
 
-void init_set_system(const char *name, const char *new) {
-    AlterSystemStmt *stmt;
-    const char *old = GetConfigOption(name, false, true);
-    bool old_isnull = !old || old[0] == '\0';
+void init_set_switchover(const char *target) {
+    TimestampTz time = GetCurrentTimestamp();
+    elog(DEBUG1, "target = %s", target ? target : "(null)");
+    journal_write(journal_switchover, target, init_state, 0, NULL);
+    SpinLockAcquire(&init_shmem->mutex);
+    strlcpy(init_shmem->switchover, target ? target : "", sizeof(init_shmem->switchover));
+    init_shmem->switchover_time = time;
+    SpinLockRelease(&init_shmem->mutex);
+}
+
+void init_alter_system(const char *name, const char *new) {
+    AlterSystemStmt *stmt = makeNode(AlterSystemStmt);
     bool new_isnull = !new || new[0] == '\0';
-    if (ShutdownRequestPending) return;
-    if (old_isnull && new_isnull) return;
-    if (!old_isnull && !new_isnull && !strcmp(old, new)) return;
-    elog(DEBUG1, "name = %s, old = %s, new = %s", name, !old_isnull ? old : "(null)", !new_isnull ? new : "(null)");
-    stmt = makeNode(AlterSystemStmt);
     stmt->setstmt = makeNode(VariableSetStmt);
     stmt->setstmt->name = (char *)name;
     stmt->setstmt->kind = !new_isnull ? VAR_SET_VALUE : VAR_RESET;
@@ -127,15 +350,96 @@ void init_set_system(const char *name, const char *new) {
     if (!new_isnull) list_free_deep(stmt->setstmt->args);
     pfree(stmt->setstmt);
     pfree(stmt);
+}
+
+void init_set_system(const char *name, const char *new) {
+    const char *old = GetConfigOption(name, false, true);
+    bool old_isnull = !old || old[0] == '\0';
+    bool new_isnull = !new || new[0] == '\0';
+    if (ShutdownRequestPending) return;
+    if (old_isnull && new_isnull) return;
+    if (!old_isnull && !new_isnull && !strcmp(old, new)) return;
+    elog(DEBUG1, "name = %s, old = %s, new = %s", name, !old_isnull ? old : "(null)", !new_isnull ? new : "(null)");
+    if (true) {
+        char data[2 * NAMEDATALEN];
+        snprintf(data, sizeof(data), "%s = %s", name, !new_isnull ? new : "(null)");
+        journal_write(journal_system, NULL, init_state, 0, data);
+    }
+    if (!helper_system(name, new)) init_alter_system(name, new);
     init_sighup = true;
 }
 
+static void init_write_history(void) {
+    FILE *file;
+    if (!init_history) return;
+    if (!(file = AllocateFile("pg_save.history.tmp", "w"))) { ereport(WARNING, (errcode_for_file_access(), errmsg("could not create file \"%s\": %m", "pg_save.history.tmp"))); return; }
+    if (init_exit_time) fprintf(file, "exit_time = '%li'\n", (long)timestamptz_to_time_t(init_exit_time));
+    if (init_kills) fprintf(file, "kills = '%i'\nkill_time = '%li'\n", init_kills, (long)timestamptz_to_time_t(init_kill_time));
+    if (init_starts) fprintf(file, "starts = '%i'\nstart_time = '%li'\n", init_starts, (long)timestamptz_to_time_t(init_start_time));
+    if (ferror(file)) { ereport(WARNING, (errcode_for_file_access(), errmsg("could not write file \"%s\": %m", "pg_save.history.tmp"))); FreeFile(file); return; }
+    if (FreeFile(file)) { ereport(WARNING, (errcode_for_file_access(), errmsg("could not close file \"%s\": %m", "pg_save.history.tmp"))); return; }
+    if (durable_rename("pg_save.history.tmp", "pg_save.history", WARNING)) return;
+    init_history = false;
+}
+
+void init_write(void) {
+    char *archiver;
+    FILE *file;
+    init_write_history();
+    if (!init_dirty) return;
+    if (!(file = AllocateFile("pg_save.conf.tmp", "w"))) { ereport(WARNING, (errcode_for_file_access(), errmsg("could not create file \"%s\": %m", "pg_save.conf.tmp"))); return; }
+    fprintf(file, "state = '%s'\n", init_state2char(init_state));
+#define XX(name) if (init_##name) fprintf(file, #name" = '%s'\n", init_##name);
+    STATE_MAP(XX)
+#undef XX
+    if ((archiver = init_archiver())) { fprintf(file, "archiver = '%s'\n", archiver); pfree(archiver); }
+    if (ferror(file)) { ereport(WARNING, (errcode_for_file_access(), errmsg("could not write file \"%s\": %m", "pg_save.conf.tmp"))); FreeFile(file); return; }
+    if (FreeFile(file)) { ereport(WARNING, (errcode_for_file_access(), errmsg("could not close file \"%s\": %m", "pg_save.conf.tmp"))); return; }
+    if (durable_rename("pg_save.conf.tmp", "pg_save.conf", WARNING)) return;
+    init_dirty = false;
+}
+
 void initStringInfoMy(MemoryContext memoryContext, StringInfoData *buf) {
     MemoryContext oldMemoryContext = MemoryContextSwitchTo(memoryContext);
     initStringInfo(buf);
     MemoryContextSwitchTo(oldMemoryContext);
 }
 
+static Size init_shmem_size(void) {
+    return MAXALIGN(sizeof(*init_shmem));
+}
+
+#if PG_VERSION_NUM >= 150000
+static void init_shmem_request(void) {
+    if (prev_shmem_request_hook) prev_shmem_request_hook();
+    RequestAddinShmemSpace(init_shmem_size());
+}
+#endif
+
+static void init_shmem_startup(void) {
+    bool found;
+    if (prev_shmem_startup_hook) prev_shmem_startup_hook();
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+    init_shmem = ShmemInitStruct("pg_save", init_shmem_size(), &found);
+    if (!found) {
+        MemSet(init_shmem, 0, init_shmem_size());
+        SpinLockInit(&init_shmem->mutex);
+    }
+    LWLockRelease(AddinShmemInitLock);
+    journal_startup();
+}
+
+static void init_hook(void) {
+#if PG_VERSION_NUM >= 150000
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = init_shmem_request;
+#else
+    RequestAddinShmemSpace(init_shmem_size());
+#endif
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = init_shmem_startup;
+}
+
 static const char *init_show(void) {
     return hostname;
 }
@@ -156,26 +460,78 @@ static void init_work(void) {
 }
 
 static void init_save(void) {
-    static const struct config_enum_entry init_state_options[] = {
-#define XX(name) {#name, state_##name, false},
-        STATE_MAP(XX)
-#undef XX
-        {NULL, 0, false}
-    };
     if (!(hostname = getenv("HOSTNAME"))) ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("can not getenv(\"HOSTNAME\")")));
     synchronous_standby_names = getenv("SYNCHRONOUS_STANDBY_NAMES");
-    DefineCustomEnumVariable("pg_save.state", "pg_save state", NULL, (int *)&init_state, state_unknown, init_state_options, PGC_SIGHUP, 0, NULL, NULL, NULL);
+    init_cluster_size = getenv("CLUSTER_SIZE") ? atoi(getenv("CLUSTER_SIZE")) : 0;
     DefineCustomIntVariable("pg_save.attempt", "pg_save attempt", NULL, &init_attempt, 10, 1, INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
+    DefineCustomIntVariable("pg_save.backup", "pg_save backup", NULL, &init_backup, 86400, 0, INT_MAX / 1000, PGC_SIGHUP, GUC_UNIT_S, NULL, NULL, NULL);
+    DefineCustomIntVariable("pg_save.backup_keep", "pg_save backup keep", NULL, &init_backup_keep, 2, 1, INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
+    DefineCustomIntVariable("pg_save.cascade_lag", "pg_save cascade lag", NULL, &init_cascade_lag, 16384, 0, MAX_KILOBYTES, PGC_SIGHUP, GUC_UNIT_KB, NULL, NULL, NULL);
+    DefineCustomIntVariable("pg_save.commit_latency", "pg_save commit latency", NULL, &init_commit_latency, 0, 0, INT_MAX, PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
+    DefineCustomIntVariable("pg_save.journal", "pg_save journal", NULL, &init_journal, 1024, 0, INT_MAX / sizeof(JournalRecord), PGC_POSTMASTER, 0, NULL, NULL, NULL);
+    DefineCustomIntVariable("pg_save.kill_limit", "pg_save kill limit", NULL, &init_kill_limit, 3, 1, INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
+    DefineCustomIntVariable("pg_save.lease", "pg_save lease", NULL, &init_lease, 0, 0, INT_MAX, PGC_SIGHUP, GUC_UNIT_MS, NULL, NULL, NULL);
+    DefineCustomIntVariable("pg_save.prewarm", "pg_save prewarm", NULL, &init_prewarm, 1024, 0, INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
+    DefineCustomIntVariable("pg_save.prewarm_refresh", "pg_save prewarm refresh", NULL, &init_prewarm_refresh, 60, 1, INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
+    DefineCustomIntVariable("pg_save.resolve_ttl", "pg_save resolve ttl", NULL, &init_resolve_ttl, 60, 1, INT_MAX / 1000, PGC_SIGHUP, GUC_UNIT_S, NULL, NULL, NULL);
     DefineCustomIntVariable("pg_save.restart", "pg_save restart", NULL, &init_restart, 10, 1, INT_MAX, PGC_POSTMASTER, 0, NULL, NULL, NULL);
     DefineCustomIntVariable("pg_save.timeout", "pg_save timeout", NULL, &init_timeout, 1000, 1, INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
     DefineCustomStringVariable("pg_save.hostname", "pg_save hostname", NULL, &init_hostname, hostname, PGC_POSTMASTER, 0, NULL, NULL, init_show);
-#define XX(name) DefineCustomStringVariable("pg_save."#name, "pg_save "#name, NULL, &init_##name, NULL, PGC_SIGHUP, 0, NULL, NULL, NULL);
-    STATE_MAP(XX)
-#undef XX
+    init_char2state_init();
     init_debug();
+    init_hook();
     init_work();
 }
 
+PG_FUNCTION_INFO_V1(pg_save_archiver);
+Datum pg_save_archiver(PG_FUNCTION_ARGS) {
+    char *archiver = init_archiver();
+    if (!archiver) PG_RETURN_NULL();
+    PG_RETURN_TEXT_P(cstring_to_text(archiver));
+}
+
+PG_FUNCTION_INFO_V1(pg_save_peers);
+Datum pg_save_peers(PG_FUNCTION_ARGS) {
+    MemoryContext oldMemoryContext;
+    Peer peers[SHMEM_PEERS];
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    if (!rsinfo || !IsA(rsinfo, ReturnSetInfo)) ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED), errmsg("set-valued function called in context that cannot accept a set")));
+    if (!(rsinfo->allowedModes & SFRM_Materialize)) ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED), errmsg("materialize mode required, but it is not allowed in this context")));
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH), errmsg("return type must be a row type")));
+    oldMemoryContext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+    MemoryContextSwitchTo(oldMemoryContext);
+    SpinLockAcquire(&init_shmem->mutex);
+    memcpy(peers, init_shmem->peers, sizeof(peers));
+    SpinLockRelease(&init_shmem->mutex);
+    for (int i = 0; i < countof(peers); i++) {
+        bool nulls[] = {false, false, false, false};
+        Datum values[countof(nulls)];
+        if (peers[i].host[0] == '\0') continue;
+        values[0] = CStringGetTextDatum(peers[i].host);
+        values[1] = Float8GetDatum(peers[i].rtt);
+        values[2] = Float8GetDatum(peers[i].jitter);
+        values[3] = TimestampTzGetDatum(peers[i].time);
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+    return (Datum)0;
+}
+
+PG_FUNCTION_INFO_V1(pg_save_switchover);
+Datum pg_save_switchover(PG_FUNCTION_ARGS) {
+    char *target = TextDatumGetCString(PG_GETARG_DATUM(0));
+    if (strlen(target) >= NAMEDATALEN) ereport(ERROR, (errcode(ERRCODE_NAME_TOO_LONG), errmsg("target \"%s\" is too long", target)));
+    if (!RecoveryInProgress() && !strcmp(target, hostname)) ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE), errmsg("target \"%s\" is already primary", target)));
+    init_set_switchover(target);
+    pfree(target);
+    PG_RETURN_VOID();
+}
+
 void _PG_init(void) {
     if (!process_shared_preload_libraries_in_progress) ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("This module can only be loaded via shared_preload_libraries")));
     init_save();
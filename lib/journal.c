@@ -0,0 +1,87 @@
+#include "lib.h"
+
+extern int init_journal;
+extern Shmem *init_shmem;
+static Journal *journal = NULL;
+
+static Size journal_size(void) {
+    return offsetof(Journal, records) + init_journal * sizeof(JournalRecord);
+}
+
+const char *journal_type2char(journal_t type) {
+    switch (type) {
+#define XX(name) case journal_##name: return #name;
+        JOURNAL_MAP(XX)
+#undef XX
+    }
+    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("unknown type = %i", type)));
+}
+
+void journal_startup(void) {
+    int fd;
+    if (journal || !init_journal) return;
+    if ((fd = open("pg_save.journal", O_RDWR | O_CREAT | PG_BINARY, S_IRUSR | S_IWUSR)) < 0) { ereport(WARNING, (errcode_for_file_access(), errmsg("could not open file \"%s\": %m", "pg_save.journal"))); return; }
+    if (ftruncate(fd, journal_size())) { ereport(WARNING, (errcode_for_file_access(), errmsg("could not truncate file \"%s\": %m", "pg_save.journal"))); close(fd); return; }
+    if ((journal = mmap(NULL, journal_size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) { ereport(WARNING, (errcode_for_file_access(), errmsg("could not map file \"%s\": %m", "pg_save.journal"))); journal = NULL; }
+    close(fd);
+    if (!journal) return;
+    if (journal->magic == JOURNAL_MAGIC && journal->count == init_journal) return;
+    MemSet(journal, 0, journal_size());
+    journal->magic = JOURNAL_MAGIC;
+    journal->count = init_journal;
+}
+
+void journal_write(journal_t type, const char *host, state_t state, int value, const char *data) {
+    JournalRecord record;
+    if (!journal) return;
+    MemSet(&record, 0, sizeof(record));
+    record.time = GetCurrentTimestamp();
+    record.pid = MyProcPid;
+    record.type = type;
+    record.state = state;
+    record.value = value;
+    if (host) strlcpy(record.host, host, sizeof(record.host));
+    if (data) strlcpy(record.data, data, sizeof(record.data));
+    SpinLockAcquire(&init_shmem->mutex);
+    journal->records[journal->next++ % journal->count] = record;
+    SpinLockRelease(&init_shmem->mutex);
+}
+
+PG_FUNCTION_INFO_V1(pg_save_journal);
+Datum pg_save_journal(PG_FUNCTION_ARGS) {
+    MemoryContext oldMemoryContext;
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    uint64 next;
+    if (!rsinfo || !IsA(rsinfo, ReturnSetInfo)) ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED), errmsg("set-valued function called in context that cannot accept a set")));
+    if (!(rsinfo->allowedModes & SFRM_Materialize)) ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED), errmsg("materialize mode required, but it is not allowed in this context")));
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH), errmsg("return type must be a row type")));
+    oldMemoryContext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+    MemoryContextSwitchTo(oldMemoryContext);
+    if (!journal) return (Datum)0;
+    SpinLockAcquire(&init_shmem->mutex);
+    next = journal->next;
+    SpinLockRelease(&init_shmem->mutex);
+    for (uint64 i = next > journal->count ? next - journal->count : 0; i < next; i++) {
+        bool nulls[] = {false, false, false, false, false, false, false};
+        Datum values[countof(nulls)];
+        JournalRecord record;
+        SpinLockAcquire(&init_shmem->mutex);
+        record = journal->records[i % journal->count];
+        SpinLockRelease(&init_shmem->mutex);
+        values[0] = TimestampTzGetDatum(record.time);
+        values[1] = Int32GetDatum(record.pid);
+        values[2] = CStringGetTextDatum(journal_type2char(record.type));
+        if (record.host[0] == '\0') nulls[3] = true; else values[3] = CStringGetTextDatum(record.host);
+        values[4] = CStringGetTextDatum(init_state2char(record.state));
+        values[5] = Int32GetDatum(record.value);
+        if (record.data[0] == '\0') nulls[6] = true; else values[6] = CStringGetTextDatum(record.data);
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+    return (Datum)0;
+}
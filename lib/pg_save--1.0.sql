@@ -0,0 +1,19 @@
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "CREATE EXTENSION pg_save" to load this file. \quit
+
+CREATE FUNCTION pg_save_archiver() RETURNS text AS 'MODULE_PATHNAME', 'pg_save_archiver' LANGUAGE C;
+
+CREATE FUNCTION pg_save_journal(OUT time timestamptz, OUT pid integer, OUT type text, OUT host text, OUT state text, OUT value integer, OUT data text) RETURNS SETOF record AS 'MODULE_PATHNAME', 'pg_save_journal' LANGUAGE C;
+REVOKE ALL ON FUNCTION pg_save_journal() FROM PUBLIC;
+
+CREATE FUNCTION pg_save_peers(OUT host text, OUT rtt float8, OUT jitter float8, OUT time timestamptz) RETURNS SETOF record AS 'MODULE_PATHNAME', 'pg_save_peers' LANGUAGE C;
+REVOKE ALL ON FUNCTION pg_save_peers() FROM PUBLIC;
+
+CREATE FUNCTION pg_save_switchover(target text) RETURNS void AS 'MODULE_PATHNAME', 'pg_save_switchover' LANGUAGE C STRICT;
+REVOKE ALL ON FUNCTION pg_save_switchover(text) FROM PUBLIC;
+
+CREATE FUNCTION pg_save_resync_checksum(path text, OUT size bigint, OUT checksums bytea) RETURNS record AS 'MODULE_PATHNAME', 'pg_save_resync_checksum' LANGUAGE C STRICT;
+REVOKE ALL ON FUNCTION pg_save_resync_checksum(text) FROM PUBLIC;
+
+CREATE FUNCTION pg_save_resync_files(OUT path text, OUT size bigint) RETURNS SETOF record AS 'MODULE_PATHNAME', 'pg_save_resync_files' LANGUAGE C;
+REVOKE ALL ON FUNCTION pg_save_resync_files() FROM PUBLIC;
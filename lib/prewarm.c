@@ -0,0 +1,95 @@
+#include "lib.h"
+
+extern int init_prewarm;
+extern int init_prewarm_refresh;
+extern MemoryContext backend_context;
+extern state_t init_state;
+
+typedef struct PrewarmBlock {
+    BlockNumber blocknum;
+    ForkNumber forknum;
+    RelFileNode rnode;
+} PrewarmBlock;
+
+static int prewarm_count = 0;
+static int prewarm_next = 0;
+static int prewarm_tick = 0;
+static PrewarmBlock *prewarm_blocks = NULL;
+
+bool prewarm_due(void) {
+    if (!init_prewarm || init_state != state_sync) return false;
+    return prewarm_tick >= init_prewarm_refresh && prewarm_next >= prewarm_count;
+}
+
+void prewarm_fini(void) {
+    if (prewarm_blocks) pfree(prewarm_blocks);
+    prewarm_blocks = NULL;
+    prewarm_count = 0;
+    prewarm_next = 0;
+}
+
+static void prewarm_result(PGresult *result) {
+    int reltablespace = PQfnumber(result, "reltablespace");
+    int reldatabase = PQfnumber(result, "reldatabase");
+    int relfilenode = PQfnumber(result, "relfilenode");
+    int relforknumber = PQfnumber(result, "relforknumber");
+    int relblocknumber = PQfnumber(result, "relblocknumber");
+    prewarm_fini();
+    prewarm_tick = 0;
+    if (!(prewarm_count = PQntuples(result))) return;
+    prewarm_blocks = MemoryContextAlloc(backend_context, prewarm_count * sizeof(*prewarm_blocks));
+    for (int row = 0; row < prewarm_count; row++) {
+        PrewarmBlock *block = &prewarm_blocks[row];
+        block->rnode.spcNode = strtoul(PQgetvalue(result, row, reltablespace), NULL, 10);
+        block->rnode.dbNode = strtoul(PQgetvalue(result, row, reldatabase), NULL, 10);
+        block->rnode.relNode = strtoul(PQgetvalue(result, row, relfilenode), NULL, 10);
+        block->forknum = atoi(PQgetvalue(result, row, relforknumber));
+        block->blocknum = strtoul(PQgetvalue(result, row, relblocknumber), NULL, 10);
+    }
+    elog(DEBUG1, "prewarm_count = %i", prewarm_count);
+}
+
+static void prewarm_select_result(Backend *backend) {
+    for (PGresult *result; PQstatus(backend->conn) == CONNECTION_OK && (result = PQgetResult(backend->conn)); ) {
+        switch (PQresultStatus(result)) {
+            case PGRES_TUPLES_OK: prewarm_result(result); break;
+            default: elog(WARNING, "%s:%s PQresultStatus = %s and %s", backend->host, init_state2char(backend->state), PQresStatus(PQresultStatus(result)), PQresultErrorMessageMy(result)); prewarm_tick = 0; break;
+        }
+        PQclear(result);
+    }
+    backend_idle(backend);
+}
+
+void prewarm_select(Backend *backend) {
+    char limit[MAXINT8LEN + 1];
+    const char *values[] = {limit};
+    snprintf(limit, sizeof(limit), "%li", Min((long)init_prewarm * init_prewarm_refresh, (long)NBuffers));
+    if (!PQsendQueryParams(backend->conn, SQL(SELECT reltablespace, reldatabase, relfilenode, relforknumber, relblocknumber FROM (SELECT * FROM pg_buffercache WHERE relfilenode IS NOT NULL ORDER BY usagecount DESC LIMIT $1::bigint) AS b ORDER BY reltablespace, reldatabase, relfilenode, relforknumber, relblocknumber), countof(values), NULL, values, NULL, NULL, false)) { elog(WARNING, "%s:%s !PQsendQueryParams and %s", backend->host, init_state2char(backend->state), PQerrorMessageMy(backend->conn)); backend_finish(backend); return; }
+    backend->socket = prewarm_select_result;
+    backend->event = WL_SOCKET_READABLE;
+}
+
+void prewarm_timeout(void) {
+    int count = 0;
+    MemoryContext oldMemoryContext = CurrentMemoryContext;
+    prewarm_tick++;
+    if (!prewarm_blocks || prewarm_next >= prewarm_count) return;
+    if (init_state != state_sync) { prewarm_fini(); return; }
+    StartTransactionCommand();
+    MemoryContextSwitchTo(oldMemoryContext);
+    for (; prewarm_next < prewarm_count && count < init_prewarm; prewarm_next++) {
+        PrewarmBlock *block = &prewarm_blocks[prewarm_next];
+        SMgrRelation smgr = smgropen(block->rnode, InvalidBackendId);
+        if (!smgrexists(smgr, block->forknum)) continue;
+        if (block->blocknum >= smgrnblocks(smgr, block->forknum)) continue;
+#if PG_VERSION_NUM >= 150000
+        ReleaseBuffer(ReadBufferWithoutRelcache(block->rnode, block->forknum, block->blocknum, RBM_NORMAL, NULL, true));
+#else
+        ReleaseBuffer(ReadBufferWithoutRelcache(block->rnode, block->forknum, block->blocknum, RBM_NORMAL, NULL));
+#endif
+        count++;
+    }
+    CommitTransactionCommand();
+    MemoryContextSwitchTo(oldMemoryContext);
+    elog(DEBUG1, "prewarm = %i, prewarm_next = %i, prewarm_count = %i", count, prewarm_next, prewarm_count);
+}
@@ -1,9 +1,31 @@
 #include "lib.h"
 
 extern char *hostname;
+extern char *synchronous_standby_names;
 extern int init_attempt;
+extern int init_cluster_size;
+extern int init_commit_latency;
+extern int init_lease;
+extern int init_timeout;
+extern MemoryContext backend_context;
+extern MemoryContext save_context;
 extern state_t init_state;
+static bool primary_fenced = false;
+static bool primary_renewed = false;
+static char *primary_slow_host = NULL;
+static char *primary_switchover_host = NULL;
+static instr_time primary_lease_time;
 static int primary_attempt = 0;
+static int primary_members = 1;
+static int primary_slow_attempt = 0;
+static List *primary_slow_list = NIL;
+static const char *primary_slow_method = NULL;
+static int primary_slow_num = 1;
+static int primary_switchover_step = 0;
+static TimestampTz primary_switchover_time = 0;
+static XLogRecPtr primary_switchover_checkpoint = InvalidXLogRecPtr;
+
+static void primary_notify(void);
 
 void primary_connected(Backend *backend) {
     primary_attempt = 0;
@@ -17,7 +39,7 @@ void primary_failed(Backend *backend) {
     backend_finish(backend);
     if (backend_nevents()) return;
     init_set_state(state_wait_standby);
-    if (kill(PostmasterPid, SIGKILL)) elog(WARNING, "kill(%i, %i)", PostmasterPid, SIGKILL);
+    init_kill(SIGKILL);
 }
 
 void primary_finished(Backend *backend) {
@@ -26,8 +48,18 @@ void primary_finished(Backend *backend) {
 void primary_fini(void) {
 }
 
+static void primary_extension(void) {
+    static char *command = SQL(CREATE EXTENSION IF NOT EXISTS pg_save);
+    SPI_connect_my(command);
+    SPI_execute_with_args_my(command, 0, NULL, NULL, NULL, SPI_OK_UTILITY, true);
+    SPI_finish_my();
+}
+
 void primary_init(void) {
+    INSTR_TIME_SET_CURRENT(primary_lease_time);
+    primary_extension();
     init_set_system("primary_conninfo", NULL);
+    init_set_system("default_transaction_read_only", NULL);
     switch (init_state) {
         case state_initial: break;
         case state_primary: break;
@@ -46,17 +78,42 @@ static void primary_demote(void) {
     elog(WARNING, "%i < %i", primary_attempt, init_attempt);
     if (primary_attempt++ < init_attempt) return;
     init_set_state(state_wait_standby);
-    if (kill(PostmasterPid, SIGKILL)) elog(WARNING, "kill(%i, %i)", PostmasterPid, SIGKILL);
+    primary_notify();
+    init_kill(SIGKILL);
+}
+
+static bool primary_archiving(void) {
+    const char *archiver = getenv("ARCHIVER");
+    return getenv("ARCLOG") && archiver && !strcmp(archiver, "standby");
+}
+
+static int primary_archiver_priority(state_t state) {
+    switch (state) {
+        case state_async: return 4;
+        case state_potential: return 3;
+        case state_quorum: return 2;
+        case state_sync: return 1;
+        default: return 0;
+    }
 }
 
 static void primary_result(void) {
+    char archiver[NAMEDATALEN] = "";
+    char *current = primary_archiving() ? init_archiver() : NULL;
+    int application_name = SPI_processed ? SPI_fnumber_my(SPI_tuptable->tupdesc, "application_name") : 0;
+    int priority = 0;
+    int sync_state = SPI_processed ? SPI_fnumber_my(SPI_tuptable->tupdesc, "sync_state") : 0;
     for (uint64 row = 0; row < SPI_processed; row++) {
-        char *host = TextDatumGetCStringMy(TopMemoryContext, SPI_getbinval_my(SPI_tuptable->vals[row], SPI_tuptable->tupdesc, "application_name", false));
-        char *state = TextDatumGetCStringMy(TopMemoryContext, SPI_getbinval_my(SPI_tuptable->vals[row], SPI_tuptable->tupdesc, "sync_state", false));
+        char host[NAMEDATALEN];
+        char state[NAMEDATALEN];
+        text_to_cstring_buffer((text *)DatumGetPointer(SPI_getbinval_fnumber_my(SPI_tuptable->vals[row], SPI_tuptable->tupdesc, application_name, false)), host, sizeof(host));
+        text_to_cstring_buffer((text *)DatumGetPointer(SPI_getbinval_fnumber_my(SPI_tuptable->vals[row], SPI_tuptable->tupdesc, sync_state, false)), state, sizeof(state));
         backend_result(host, init_char2state(state));
-        pfree(host);
-        pfree(state);
+        if (current && !strcmp(current, host)) { priority = INT_MAX; strlcpy(archiver, host, sizeof(archiver)); }
+        else if (primary_archiver_priority(init_char2state(state)) > priority) { priority = primary_archiver_priority(init_char2state(state)); strlcpy(archiver, host, sizeof(archiver)); }
     }
+    if (primary_archiving()) init_set_archiver(archiver[0] != '\0' ? archiver : hostname);
+    if (current) pfree(current);
     if (!SPI_processed) switch (init_state) {
         case state_initial: init_set_state(state_single); break;
         case state_primary: init_set_state(state_wait_primary); break;
@@ -72,6 +129,329 @@ static void primary_result(void) {
     init_reload();
 }
 
+static bool primary_caught_up(const char *host, XLogRecPtr checkpoint) {
+    bool caught_up = false;
+    char lsn[MAXFNAMELEN];
+    static Oid argtypes[] = {TEXTOID, TEXTOID};
+    static SPIPlanPtr plan = NULL;
+    static char *command = SQL(SELECT coalesce(flush_lsn >= pg_current_wal_flush_lsn(), false) AND (SELECT checkpoint_lsn FROM pg_control_checkpoint()) >= $2::pg_lsn AS caught_up FROM pg_stat_replication WHERE application_name = $1);
+    Datum values[countof(argtypes)];
+    snprintf(lsn, sizeof(lsn), "%X/%X", (uint32)(checkpoint >> 32), (uint32)checkpoint);
+    values[0] = CStringGetTextDatum(host);
+    values[1] = CStringGetTextDatum(lsn);
+    SPI_connect_my(command);
+    if (!plan) plan = SPI_prepare_my(command, countof(argtypes), argtypes);
+    SPI_execute_plan_my(plan, values, NULL, SPI_OK_SELECT, false);
+    if (SPI_processed == 1) caught_up = DatumGetBool(SPI_getbinval_my(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, "caught_up", false));
+    SPI_commit_my();
+    SPI_finish_my();
+    pfree(DatumGetPointer(values[0]));
+    pfree(DatumGetPointer(values[1]));
+    return caught_up;
+}
+
+static void primary_switchover_cancel(void) {
+    elog(WARNING, "switchover to %s cancelled", primary_switchover_host);
+    journal_write(journal_switchover, primary_switchover_host, init_state, -1, NULL);
+    pfree(primary_switchover_host);
+    primary_switchover_host = NULL;
+    primary_switchover_step = 0;
+    if (!primary_fenced) init_set_system("synchronous_standby_names", synchronous_standby_names);
+    init_set_system("default_transaction_read_only", NULL);
+    init_reload();
+}
+
+static void primary_switchover_result(Backend *backend) {
+    bool ok = false;
+    for (PGresult *result; PQstatus(backend->conn) == CONNECTION_OK && (result = PQgetResult(backend->conn)); ) {
+        switch (PQresultStatus(result)) {
+            case PGRES_TUPLES_OK: ok = true; break;
+            default: elog(WARNING, "%s:%s PQresultStatus = %s and %s", backend->host, init_state2char(backend->state), PQresStatus(PQresultStatus(result)), PQresultErrorMessageMy(result)); break;
+        }
+        PQclear(result);
+    }
+    backend_idle(backend);
+    if (!primary_switchover_host || strcmp(primary_switchover_host, backend->host)) return;
+    if (!ok) { primary_switchover_cancel(); return; }
+    elog(LOG, "switchover to %s", backend->host);
+    init_set_state(state_wait_standby);
+    primary_notify();
+    init_kill(SIGINT);
+}
+
+static bool primary_switchover_send(Backend *backend) {
+    const char *values[] = {primary_switchover_host};
+    if (PQstatus(backend->conn) != CONNECTION_OK || !backend_idling(backend)) return false;
+    if (!PQsendQueryParams(backend->conn, SQL(SELECT pg_save_switchover($1)), countof(values), NULL, values, NULL, NULL, false)) { elog(WARNING, "%s:%s !PQsendQueryParams and %s", backend->host, init_state2char(backend->state), PQerrorMessageMy(backend->conn)); return false; }
+    backend->socket = primary_switchover_result;
+    backend->event = WL_SOCKET_READABLE;
+    return true;
+}
+
+static void primary_switchover_other(Backend *backend) {
+    if (strcmp(backend->host, primary_switchover_host)) primary_switchover_send(backend);
+}
+
+static void primary_switchover_writers(void) {
+#if PG_VERSION_NUM >= 100000
+    static SPIPlanPtr plan = NULL;
+    static char *command = SQL(SELECT pg_terminate_backend(pid) FROM pg_stat_activity WHERE backend_type = 'client backend' AND backend_xid IS NOT NULL AND pid <> pg_backend_pid());
+    SPI_connect_my(command);
+    if (!plan) plan = SPI_prepare_my(command, 0, NULL);
+    SPI_execute_plan_my(plan, NULL, NULL, SPI_OK_SELECT, false);
+    if (SPI_processed) elog(LOG, "switchover terminated %lu writers", (unsigned long)SPI_processed);
+    SPI_commit_my();
+    SPI_finish_my();
+#endif
+}
+
+static void primary_switchover_tick(void) {
+    Backend *backend;
+    if (TimestampDifferenceExceeds(primary_switchover_time, GetCurrentTimestamp(), 2 * init_attempt * init_timeout)) { primary_switchover_cancel(); return; }
+    if (primary_switchover_step > 2) return;
+    if (!(backend = backend_host(primary_switchover_host)) || PQstatus(backend->conn) != CONNECTION_OK) { primary_switchover_cancel(); return; }
+    primary_switchover_writers();
+    if (!primary_caught_up(primary_switchover_host, primary_switchover_checkpoint)) return;
+    if (primary_switchover_step == 1) {
+        primary_switchover_checkpoint = GetXLogInsertRecPtr();
+        RequestCheckpoint(CHECKPOINT_IMMEDIATE | CHECKPOINT_FORCE);
+        primary_switchover_step = 2;
+        return;
+    }
+    if (!backend_idling(backend)) return;
+    if (!primary_switchover_send(backend)) { primary_switchover_cancel(); return; }
+    primary_switchover_step = 3;
+    backend_foreach(primary_switchover_other);
+}
+
+static void primary_switchover(void) {
+    Backend *backend;
+    char *target;
+    if (primary_switchover_host) { primary_switchover_tick(); return; }
+    if (primary_fenced || !(target = init_switchover())) return;
+    init_set_switchover(NULL);
+    if (!(backend = backend_host(target)) || backend->state != state_sync || PQstatus(backend->conn) != CONNECTION_OK) { elog(WARNING, "switchover target %s is not a connected sync standby", target); pfree(target); return; }
+    elog(LOG, "switchover to %s started", target);
+    primary_switchover_host = MemoryContextStrdup(backend_context, target);
+    primary_switchover_checkpoint = InvalidXLogRecPtr;
+    primary_switchover_step = 1;
+    primary_switchover_time = GetCurrentTimestamp();
+    pfree(target);
+    init_set_system("synchronous_standby_names", "pg_save_switchover");
+    init_set_system("default_transaction_read_only", "on");
+    init_reload();
+}
+
+#if PG_VERSION_NUM >= 100000
+static int64 primary_syncrep_wait(void) {
+    int count = 0;
+    int64 wait = 0;
+    instr_time now;
+    instr_time *since;
+    int32 *pid;
+    TimestampTz *xact;
+    static int primary_syncrep_count = 0;
+    static instr_time *primary_syncrep_since = NULL;
+    static int32 *primary_syncrep_pid = NULL;
+    static TimestampTz *primary_syncrep_xact = NULL;
+    static SPIPlanPtr plan = NULL;
+    static char *command = SQL(SELECT pid, xact_start FROM pg_stat_activity WHERE wait_event = 'SyncRep' AND xact_start IS NOT NULL);
+    INSTR_TIME_SET_CURRENT(now);
+    SPI_connect_my(command);
+    if (!plan) plan = SPI_prepare_my(command, 0, NULL);
+    SPI_execute_plan_my(plan, NULL, NULL, SPI_OK_SELECT, false);
+    since = MemoryContextAlloc(backend_context, (SPI_processed + 1) * sizeof(*since));
+    pid = MemoryContextAlloc(backend_context, (SPI_processed + 1) * sizeof(*pid));
+    xact = MemoryContextAlloc(backend_context, (SPI_processed + 1) * sizeof(*xact));
+    for (uint64 row = 0; row < SPI_processed; row++, count++) {
+        instr_time duration;
+        pid[count] = DatumGetInt32(SPI_getbinval_my(SPI_tuptable->vals[row], SPI_tuptable->tupdesc, "pid", false));
+        xact[count] = DatumGetTimestampTz(SPI_getbinval_my(SPI_tuptable->vals[row], SPI_tuptable->tupdesc, "xact_start", false));
+        since[count] = now;
+        for (int i = 0; i < primary_syncrep_count; i++) if (primary_syncrep_pid[i] == pid[count] && primary_syncrep_xact[i] == xact[count]) { since[count] = primary_syncrep_since[i]; break; }
+        duration = now;
+        INSTR_TIME_SUBTRACT(duration, since[count]);
+        wait = Max(wait, (int64)INSTR_TIME_GET_MILLISEC(duration));
+    }
+    SPI_commit_my();
+    SPI_finish_my();
+    if (primary_syncrep_since) pfree(primary_syncrep_since);
+    if (primary_syncrep_pid) pfree(primary_syncrep_pid);
+    if (primary_syncrep_xact) pfree(primary_syncrep_xact);
+    primary_syncrep_count = count;
+    primary_syncrep_since = since;
+    primary_syncrep_pid = pid;
+    primary_syncrep_xact = xact;
+    return wait;
+}
+
+static void primary_slow_restore(const char *reason) {
+    elog(LOG, "restore %s to synchronous_standby_names: %s", primary_slow_host, reason);
+    journal_write(journal_latency, primary_slow_host, init_state, -1, reason);
+    pfree(primary_slow_host);
+    primary_slow_host = NULL;
+    primary_slow_attempt = 0;
+    if (primary_fenced || primary_switchover_host) return;
+    init_set_system("synchronous_standby_names", init_state == state_primary ? synchronous_standby_names : NULL);
+    init_reload();
+}
+
+static bool primary_slow_names(void) {
+    char *list;
+    char *names;
+    char *str;
+    if (primary_slow_method) return true;
+    str = names = MemoryContextStrdup(backend_context, synchronous_standby_names);
+    while (isspace((unsigned char)*str)) str++;
+    primary_slow_method = "FIRST";
+    primary_slow_num = 1;
+    if (!pg_strncasecmp(str, "FIRST", sizeof("FIRST") - 1) && isspace((unsigned char)str[sizeof("FIRST") - 1])) str += sizeof("FIRST") - 1;
+    else if (!pg_strncasecmp(str, "ANY", sizeof("ANY") - 1) && isspace((unsigned char)str[sizeof("ANY") - 1])) { primary_slow_method = "ANY"; str += sizeof("ANY") - 1; }
+    if ((list = strchr(str, '('))) {
+        char *end;
+        primary_slow_num = strtol(str, &end, 10);
+        while (isspace((unsigned char)*end)) end++;
+        if (end != list || primary_slow_num < 1 || !(end = strrchr(++list, ')'))) { elog(WARNING, "can not parse synchronous_standby_names = '%s'", synchronous_standby_names); primary_slow_method = NULL; pfree(names); return false; }
+        *end = '\0';
+    } else list = str;
+    if (!SplitIdentifierString(list, ',', &primary_slow_list)) { elog(WARNING, "can not parse synchronous_standby_names = '%s'", synchronous_standby_names); primary_slow_method = NULL; primary_slow_list = NIL; pfree(names); return false; }
+    return true;
+}
+
+static bool primary_slow_member(const char *host) {
+    ListCell *cell;
+    foreach(cell, primary_slow_list) {
+        const char *name = lfirst(cell);
+        if (!strcmp(name, "*") || !pg_strcasecmp(name, host)) return true;
+    }
+    return false;
+}
+
+static void primary_slow_exclude(const char *candidates) {
+    char *names = psprintf("%s %i (%s)", primary_slow_method, primary_slow_num, candidates);
+    init_set_system("synchronous_standby_names", names);
+    pfree(names);
+}
+
+static void primary_latency(void) {
+    char slow[NAMEDATALEN] = "";
+    int candidates = 0;
+    int64 slow_lag = -1;
+    int64 wait;
+    static SPIPlanPtr plan = NULL;
+    static char *command = SQL(SELECT r.application_name, r.sync_state, greatest(coalesce(extract(epoch FROM r.flush_lag) * 1000, 0), coalesce(p.rtt, 0))::bigint AS lag FROM pg_stat_replication AS r LEFT JOIN pg_save_peers() AS p ON p.host = r.application_name WHERE r.state = 'streaming' ORDER BY lag, r.application_name);
+    StringInfoData buf;
+    if (primary_slow_host && (!init_commit_latency || init_state != state_primary || !synchronous_standby_names)) primary_slow_restore(init_state != state_primary ? "not primary" : "disabled");
+    if (!init_commit_latency || init_state != state_primary || !synchronous_standby_names || primary_switchover_host || primary_fenced || !primary_slow_names()) { primary_slow_attempt = 0; return; }
+    wait = primary_syncrep_wait();
+    initStringInfoMy(save_context, &buf);
+    SPI_connect_my(command);
+    if (!plan) plan = SPI_prepare_my(command, 0, NULL);
+    SPI_execute_plan_my(plan, NULL, NULL, SPI_OK_SELECT, false);
+    for (uint64 row = 0; row < SPI_processed; row++) {
+        char host[NAMEDATALEN];
+        char state[NAMEDATALEN];
+        int64 lag = DatumGetInt64(SPI_getbinval_my(SPI_tuptable->vals[row], SPI_tuptable->tupdesc, "lag", false));
+        text_to_cstring_buffer((text *)DatumGetPointer(SPI_getbinval_my(SPI_tuptable->vals[row], SPI_tuptable->tupdesc, "application_name", false)), host, sizeof(host));
+        text_to_cstring_buffer((text *)DatumGetPointer(SPI_getbinval_my(SPI_tuptable->vals[row], SPI_tuptable->tupdesc, "sync_state", false)), state, sizeof(state));
+        if (primary_slow_host ? !strcmp(host, primary_slow_host) : (init_char2state(state) == state_sync || init_char2state(state) == state_quorum)) {
+            if (slow[0] != '\0' && primary_slow_member(slow)) { appendStringInfo(&buf, "%s%s", buf.len ? ", " : "", quote_identifier(slow)); candidates++; }
+            strlcpy(slow, host, sizeof(slow));
+            slow_lag = lag;
+        }
+        else if (primary_slow_member(host)) { appendStringInfo(&buf, "%s%s", buf.len ? ", " : "", quote_identifier(host)); candidates++; }
+    }
+    SPI_commit_my();
+    SPI_finish_my();
+    if (primary_slow_host) {
+        if (slow[0] == '\0') primary_slow_restore("disconnected");
+        else if (candidates < primary_slow_num) primary_slow_restore("no candidate");
+        else if (slow_lag > init_commit_latency / 2) primary_slow_attempt = 0;
+        else if (++primary_slow_attempt >= init_attempt) primary_slow_restore("recovered");
+        if (primary_slow_host) primary_slow_exclude(buf.data);
+        pfree(buf.data);
+        return;
+    }
+    if (wait <= init_commit_latency) { primary_slow_attempt = 0; pfree(buf.data); return; }
+    elog(WARNING, "SyncRep wait %li ms > commit_latency %i ms, %i < %i", (long)wait, init_commit_latency, primary_slow_attempt, init_attempt);
+    if (primary_slow_attempt++ < init_attempt) { pfree(buf.data); return; }
+    primary_slow_attempt = 0;
+    if (slow[0] == '\0' || candidates < primary_slow_num) { elog(WARNING, "no faster candidate for slow synchronous standby %s", slow[0] != '\0' ? slow : "(null)"); pfree(buf.data); return; }
+    elog(LOG, "remove %s from synchronous_standby_names: flush lag %li ms", slow, (long)slow_lag);
+    journal_write(journal_latency, slow, init_state, wait, "slow");
+    primary_slow_host = MemoryContextStrdup(backend_context, slow);
+    primary_slow_exclude(buf.data);
+    init_reload();
+    pfree(buf.data);
+}
+#endif
+
+static void primary_notify(void) {
+    char *archiver;
+    static char topology[NOTIFY_PAYLOAD_MAX_LENGTH];
+    static Oid argtypes[] = {TEXTOID};
+    static SPIPlanPtr plan = NULL;
+    static char *command = SQL(SELECT pg_notify('pg_save', $1));
+    Datum values[1];
+    StringInfoData buf;
+    initStringInfoMy(save_context, &buf);
+    appendStringInfo(&buf, "%s=%s", hostname, init_state2char(init_state));
+    backend_topology(&buf);
+    if ((archiver = init_archiver())) { appendStringInfo(&buf, ",archiver=%s", archiver); pfree(archiver); }
+    if (buf.len >= sizeof(topology) || !strcmp(buf.data, topology)) { pfree(buf.data); return; }
+    elog(DEBUG1, "topology = %s", buf.data);
+    values[0] = CStringGetTextDatum(buf.data);
+    SPI_connect_my(command);
+    if (!plan) plan = SPI_prepare_my(command, countof(argtypes), argtypes);
+    SPI_execute_plan_my(plan, values, NULL, SPI_OK_SELECT, true);
+    SPI_finish_my();
+    strlcpy(topology, buf.data, sizeof(topology));
+    pfree(DatumGetPointer(values[0]));
+    pfree(buf.data);
+}
+
+static void primary_quorum(void) {
+    bool sync = false;
+    int64 streaming = 0;
+    static SPIPlanPtr plan = NULL;
+    static char *command = SQL(SELECT count(*) AS streaming, coalesce(bool_or(sync_state = 'sync'), false) AS sync FROM pg_stat_replication WHERE state = 'streaming');
+    SPI_connect_my(command);
+    if (!plan) plan = SPI_prepare_my(command, 0, NULL);
+    SPI_execute_plan_my(plan, NULL, NULL, SPI_OK_SELECT, false);
+    if (SPI_processed == 1) {
+        streaming = DatumGetInt64(SPI_getbinval_my(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, "streaming", false));
+        sync = DatumGetBool(SPI_getbinval_my(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, "sync", false));
+    }
+    SPI_commit_my();
+    SPI_finish_my();
+    primary_members = Max(primary_members, Max(backend_count(), streaming) + 1);
+    primary_renewed = 2 * (streaming + 1) > (init_cluster_size > 0 ? Max(init_cluster_size, streaming + 1) : primary_members) && (sync || init_state != state_primary);
+}
+
+static void primary_lease(void) {
+    instr_time now;
+    INSTR_TIME_SET_CURRENT(now);
+    if (!init_lease || primary_renewed) {
+        primary_lease_time = now;
+        if (!primary_fenced) return;
+        elog(LOG, "lease renewed, unfence");
+        journal_write(journal_lease, hostname, init_state, -1, NULL);
+        primary_fenced = false;
+        init_set_system("synchronous_standby_names", init_state == state_primary ? synchronous_standby_names : NULL);
+        init_reload();
+        return;
+    }
+    INSTR_TIME_SUBTRACT(now, primary_lease_time);
+    if ((long)INSTR_TIME_GET_MILLISEC(now) <= init_lease) return;
+    if (!primary_fenced) {
+        elog(WARNING, "lease expired %li ms ago, fence", (long)INSTR_TIME_GET_MILLISEC(now) - init_lease);
+        journal_write(journal_lease, hostname, init_state, 1, NULL);
+        primary_fenced = true;
+    }
+    init_set_system("synchronous_standby_names", "pg_save_fence");
+    init_reload();
+}
+
 void primary_timeout(void) {
     static SPIPlanPtr plan = NULL;
     static char *command = SQL(SELECT * FROM pg_stat_replication WHERE state = 'streaming' AND NOT EXISTS (SELECT * FROM pg_stat_progress_basebackup));
@@ -81,7 +461,15 @@ void primary_timeout(void) {
     primary_result();
     SPI_commit_my();
     SPI_finish_my();
+    primary_quorum();
+    primary_lease();
+    primary_notify();
+#if PG_VERSION_NUM >= 100000
+    primary_latency();
+#endif
+    primary_switchover();
     primary_demote();
+    backup_timeout();
 }
 
 void primary_updated(Backend *backend) {
@@ -0,0 +1,104 @@
+#include "lib.h"
+
+static const char *resync_exclude[] = {
+#define XX(name) name,
+    RESYNC_EXCLUDE_MAP(XX)
+#undef XX
+};
+
+static bool resync_excluded(const char *path) {
+    char arclog[MAXPGPATH];
+    const char *env = getenv("ARCLOG");
+    for (int i = 0; i < countof(resync_exclude); i++) if (!strcmp(path, resync_exclude[i])) return true;
+    if (!env || is_absolute_path(env)) return false;
+    strlcpy(arclog, env, sizeof(arclog));
+    canonicalize_path(arclog);
+    return !strcmp(path, arclog);
+}
+
+static void resync_check(const char *path) {
+    if (is_absolute_path(path) || path_contains_parent_reference(path)) ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE), errmsg("path \"%s\" is not a relative path inside data directory", path)));
+}
+
+static void resync_files(Tuplestorestate *tupstore, TupleDesc tupdesc, const char *dir) {
+    DIR *dirp;
+    struct dirent *de;
+    if (!(dirp = AllocateDir(dir[0] != '\0' ? dir : "."))) ereport(ERROR, (errcode_for_file_access(), errmsg("could not open directory \"%s\": %m", dir)));
+    while ((de = ReadDir(dirp, dir[0] != '\0' ? dir : "."))) {
+        bool nulls[] = {false, false};
+        char path[MAXPGPATH];
+        Datum values[countof(nulls)];
+        struct stat sb;
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+        if (dir[0] != '\0') snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        else strlcpy(path, de->d_name, sizeof(path));
+        if (resync_excluded(path)) continue;
+        if (stat(path, &sb)) { if (errno == ENOENT) continue; ereport(ERROR, (errcode_for_file_access(), errmsg("could not stat file \"%s\": %m", path))); }
+        if (S_ISDIR(sb.st_mode)) { resync_files(tupstore, tupdesc, path); continue; }
+        if (!S_ISREG(sb.st_mode)) continue;
+        values[0] = CStringGetTextDatum(path);
+        values[1] = Int64GetDatum(sb.st_size);
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+    FreeDir(dirp);
+}
+
+PG_FUNCTION_INFO_V1(pg_save_resync_files);
+Datum pg_save_resync_files(PG_FUNCTION_ARGS) {
+    MemoryContext oldMemoryContext;
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    if (!rsinfo || !IsA(rsinfo, ReturnSetInfo)) ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED), errmsg("set-valued function called in context that cannot accept a set")));
+    if (!(rsinfo->allowedModes & SFRM_Materialize)) ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED), errmsg("materialize mode required, but it is not allowed in this context")));
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH), errmsg("return type must be a row type")));
+    oldMemoryContext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+    MemoryContextSwitchTo(oldMemoryContext);
+    resync_files(tupstore, tupdesc, "");
+    return (Datum)0;
+}
+
+PG_FUNCTION_INFO_V1(pg_save_resync_checksum);
+Datum pg_save_resync_checksum(PG_FUNCTION_ARGS) {
+    bool nulls[] = {false, false};
+    bytea *checksums;
+    char *path = TextDatumGetCString(PG_GETARG_DATUM(0));
+    char buf[BLCKSZ];
+    Datum values[countof(nulls)];
+    int fd;
+    int64 count;
+    struct stat sb;
+    TupleDesc tupdesc;
+    resync_check(path);
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH), errmsg("return type must be a row type")));
+    if ((fd = OpenTransientFile(path, O_RDONLY | PG_BINARY)) < 0) {
+        if (errno == ENOENT) PG_RETURN_NULL();
+        ereport(ERROR, (errcode_for_file_access(), errmsg("could not open file \"%s\": %m", path)));
+    }
+    if (fstat(fd, &sb)) ereport(ERROR, (errcode_for_file_access(), errmsg("could not stat file \"%s\": %m", path)));
+    count = (sb.st_size + BLCKSZ - 1) / BLCKSZ;
+    checksums = palloc(VARHDRSZ + count * sizeof(ResyncDigest));
+    SET_VARSIZE(checksums, VARHDRSZ + count * sizeof(ResyncDigest));
+    for (int64 block = 0; block < count; block++) {
+        pg_crc32c crc;
+        ssize_t len;
+        ResyncDigest digest = {0};
+        if ((len = pread(fd, buf, Min(BLCKSZ, sb.st_size - block * BLCKSZ), block * BLCKSZ)) < 0) ereport(ERROR, (errcode_for_file_access(), errmsg("could not read file \"%s\": %m", path)));
+        INIT_CRC32C(crc);
+        COMP_CRC32C(crc, buf, len);
+        FIN_CRC32C(crc);
+        digest.crc = htonl(crc);
+        if (len >= sizeof(digest.lsn)) memcpy(digest.lsn, buf, sizeof(digest.lsn));
+        memcpy(VARDATA(checksums) + block * sizeof(digest), &digest, sizeof(digest));
+        CHECK_FOR_INTERRUPTS();
+    }
+    CloseTransientFile(fd);
+    values[0] = Int64GetDatum(sb.st_size);
+    values[1] = PointerGetDatum(checksums);
+    pfree(path);
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(BlessTupleDesc(tupdesc), values, nulls)));
+}
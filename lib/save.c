@@ -2,6 +2,8 @@
 
 extern char *hostname;
 extern int init_timeout;
+extern MemoryContext backend_context;
+MemoryContext save_context;
 
 static void save_init(void) {
     if (!EnableHotStandby) ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("hot standby is not set")));
@@ -16,6 +18,11 @@ static void save_init(void) {
 #endif
     pgstat_report_appname(hostname);
     process_session_preload_libraries();
+    save_context = AllocSetContextCreate(TopMemoryContext, "save_worker", ALLOCSET_DEFAULT_SIZES);
+    init_read();
+    init_debug();
+    init_started();
+    helper_init();
     backend_init();
 }
 
@@ -25,6 +32,12 @@ static void save_reload(void) {
     init_debug();
 }
 
+static void save_memory(void) {
+#if PG_VERSION_NUM >= 130000
+    elog(DEBUG1, "TopMemoryContext = %zu, Backend = %zu", MemoryContextMemAllocated(TopMemoryContext, true), MemoryContextMemAllocated(backend_context, true));
+#endif
+}
+
 static void save_latch(void) {
     ResetLatch(MyLatch);
     CHECK_FOR_INTERRUPTS();
@@ -37,9 +50,10 @@ void save_worker(Datum main_arg) {
     long cur_timeout = -1;
     save_init();
     while (!ShutdownRequestPending) {
+        MemoryContext oldMemoryContext = MemoryContextSwitchTo(save_context);
         int nevents = 2 + backend_nevents();
-        WaitEvent *events = MemoryContextAllocZero(TopMemoryContext, nevents * sizeof(*events));
-        WaitEventSet *set = CreateWaitEventSet(TopMemoryContext, nevents);
+        WaitEvent *events = palloc0(nevents * sizeof(*events));
+        WaitEventSet *set = CreateWaitEventSet(save_context, nevents);
         backend_event(set);
         if (init_timeout >= 0 && cur_timeout <= 0) {
             INSTR_TIME_SET_CURRENT(start_time);
@@ -57,14 +71,17 @@ void save_worker(Datum main_arg) {
             if (event->events & WL_SOCKET_READABLE) backend_readable(event->user_data);
             if (event->events & WL_SOCKET_WRITEABLE) backend_writeable(event->user_data);
         }
+        helper_receive();
         if (init_timeout >= 0) {
             INSTR_TIME_SET_CURRENT(cur_time);
             INSTR_TIME_SUBTRACT(cur_time, start_time);
             cur_timeout = init_timeout - (long)INSTR_TIME_GET_MILLISEC(cur_time);
-            if (cur_timeout <= 0) backend_timeout();
+            if (cur_timeout <= 0) { backend_timeout(); save_memory(); }
         }
         FreeWaitEventSet(set);
-        pfree(events);
+        MemoryContextSwitchTo(oldMemoryContext);
+        MemoryContextReset(save_context);
     }
     backend_fini();
+    helper_fini();
 }
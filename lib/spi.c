@@ -1,13 +1,23 @@
 #include "lib.h"
 
-Datum SPI_getbinval_my(HeapTupleData *tuple, TupleDesc tupdesc, const char *fname, bool allow_null) {
+Datum SPI_getbinval_fnumber_my(HeapTupleData *tuple, TupleDesc tupdesc, int fnumber, bool allow_null) {
     bool isnull;
-    Datum datum = SPI_getbinval(tuple, tupdesc, SPI_fnumber(tupdesc, fname), &isnull);
+    Datum datum = SPI_getbinval(tuple, tupdesc, fnumber, &isnull);
     if (allow_null) return datum;
-    if (isnull) ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED), errmsg("column \"%s\" must not be null", fname)));
+    if (isnull) ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED), errmsg("column \"%s\" must not be null", SPI_fname(tupdesc, fnumber))));
     return datum;
 }
 
+Datum SPI_getbinval_my(HeapTupleData *tuple, TupleDesc tupdesc, const char *fname, bool allow_null) {
+    return SPI_getbinval_fnumber_my(tuple, tupdesc, SPI_fnumber_my(tupdesc, fname), allow_null);
+}
+
+int SPI_fnumber_my(TupleDesc tupdesc, const char *fname) {
+    int fnumber;
+    if ((fnumber = SPI_fnumber(tupdesc, fname)) == SPI_ERROR_NOATTRIBUTE) ereport(ERROR, (errcode(ERRCODE_UNDEFINED_COLUMN), errmsg("column \"%s\" does not exist", fname)));
+    return fnumber;
+}
+
 SPIPlanPtr SPI_prepare_my(const char *src, int nargs, Oid *argtypes) {
     int rc;
     SPIPlanPtr plan;
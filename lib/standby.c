@@ -2,10 +2,25 @@
 
 extern char *hostname;
 extern int init_attempt;
+extern int init_cascade_lag;
+extern int init_lease;
+extern int init_timeout;
+extern MemoryContext backend_context;
+extern MemoryContext save_context;
 extern state_t init_state;
 static Backend *standby_primary = NULL;
+static bool standby_listening = false;
+static int standby_promote_attempt = 0;
+static TimestampTz standby_promote_time = 0;
+static bool standby_resyncing = false;
+static instr_time standby_contact;
+static TimestampTz standby_receipt = 0;
+static char *standby_upstream = NULL;
+
+static void standby_select(Backend *backend);
 
 void standby_connected(Backend *backend) {
+    if (backend == standby_primary) standby_listening = false;
 }
 
 void standby_created(Backend *backend) {
@@ -26,21 +41,63 @@ static void standby_create(const char *conninfo) {
     PQconninfoFree(opts);
 }
 
+static void standby_create_primary(void) {
+    const char *primary = init_state2host(state_primary);
+    if (primary && strcmp(primary, hostname)) backend_create(primary, state_wait_primary);
+#if PG_VERSION_NUM >= 120000
+    else standby_create(PrimaryConnInfo);
+#endif
+}
+
+#if PG_VERSION_NUM >= 120000
+static void standby_promote_start(void) {
+    standby_promote_time = GetCurrentTimestamp();
+    elog(LOG, "promote attempt = %i", standby_promote_attempt);
+    if (!DatumGetBool(DirectFunctionCall2(pg_promote, BoolGetDatum(false), Int32GetDatum(0)))) elog(WARNING, "!pg_promote");
+}
+#endif
+
+bool standby_promoting(void) {
+    long secs;
+    int usecs;
+    if (!standby_promote_time) return false;
+    TimestampDifference(standby_promote_time, GetCurrentTimestamp(), &secs, &usecs);
+    if (!RecoveryInProgress()) {
+        elog(LOG, "promoted in %li ms", secs * 1000 + usecs / 1000);
+        standby_promote_time = 0;
+        primary_init();
+        return false;
+    }
+    if (!TimestampDifferenceExceeds(standby_promote_time, GetCurrentTimestamp(), init_attempt * init_timeout)) { elog(LOG, "promoting for %li ms", secs * 1000 + usecs / 1000); return true; }
+    journal_write(journal_fail, hostname, init_state, standby_promote_attempt, "promote");
+#if PG_VERSION_NUM >= 120000
+    if (++standby_promote_attempt < 2) { elog(WARNING, "promote did not finish in %i ms, retrying", init_attempt * init_timeout); standby_promote_start(); return true; }
+    if (unlink(PROMOTE_SIGNAL_FILE) && errno != ENOENT) ereport(WARNING, (errcode_for_file_access(), errmsg("could not remove file \"%s\": %m", PROMOTE_SIGNAL_FILE)));
+#endif
+    elog(WARNING, "promote did not finish, leaving it to another candidate");
+    standby_promote_time = 0;
+    init_set_state(state_wait_standby);
+    init_kill(SIGKILL);
+    return true;
+}
+
 static void standby_promote(Backend *backend) {
     elog(DEBUG1, "state = %s", init_state2char(init_state));
+    journal_write(journal_promote, backend->host, init_state, backend->attempt, NULL);
     init_set_host(backend->host, state_wait_standby);
     init_set_state(state_wait_primary);
     backend_finish(backend);
+    prewarm_fini();
 #if PG_VERSION_NUM >= 120000
-    if (!DatumGetBool(DirectFunctionCall2(pg_promote, BoolGetDatum(true), Int32GetDatum(30)))) elog(WARNING, "!pg_promote");
-    else primary_init();
+    standby_promote_attempt = 0;
+    standby_promote_start();
 #endif
 }
 
 static void standby_reprimary(Backend *backend) {
     StringInfoData buf;
     if (standby_primary) { init_set_host(standby_primary->host, state_wait_standby); backend_finish(standby_primary); }
-    initStringInfoMy(TopMemoryContext, &buf);
+    initStringInfoMy(save_context, &buf);
     appendStringInfo(&buf, "host=%s application_name=%s target_session_attrs=read-write", backend->host, hostname);
     init_set_host(backend->host, state_wait_primary);
     backend_finish(backend);
@@ -49,25 +106,112 @@ static void standby_reprimary(Backend *backend) {
     pfree(buf.data);
 }
 
+static bool standby_heartbeat(void) {
+    TimestampTz receipt;
+    WalRcvState state;
+    SpinLockAcquire(&WalRcv->mutex);
+    state = WalRcv->walRcvState;
+    receipt = WalRcv->lastMsgReceiptTime;
+    SpinLockRelease(&WalRcv->mutex);
+    if (state != WALRCV_STREAMING || !wal_receiver_timeout || !receipt) return false;
+    return !TimestampDifferenceExceeds(receipt, GetCurrentTimestamp(), wal_receiver_timeout);
+}
+
+static long standby_lease(void) {
+    instr_time now;
+    TimestampTz receipt;
+    SpinLockAcquire(&WalRcv->mutex);
+    receipt = WalRcv->lastMsgReceiptTime;
+    SpinLockRelease(&WalRcv->mutex);
+    INSTR_TIME_SET_CURRENT(now);
+    if (receipt != standby_receipt) { standby_receipt = receipt; standby_contact = now; }
+    if (!standby_receipt) return -1;
+    INSTR_TIME_SUBTRACT(now, standby_contact);
+    return (long)INSTR_TIME_GET_MILLISEC(now) - ((long)init_lease + wal_sender_timeout + init_timeout);
+}
+
+static bool standby_streaming(void) {
+    WalRcvState state;
+    SpinLockAcquire(&WalRcv->mutex);
+    state = WalRcv->walRcvState;
+    SpinLockRelease(&WalRcv->mutex);
+    return state == WALRCV_STREAMING;
+}
+
+static bool standby_switchover_failed(Backend *backend) {
+    bool done = true;
+    Backend *target;
+    char *switchover;
+    if (!(switchover = init_switchover())) return false;
+    init_set_switchover(NULL);
+    elog(LOG, "switchover to %s", switchover);
+    if (!strcmp(switchover, hostname)) standby_promote(backend);
+    else if ((target = backend_host(switchover))) standby_reprimary(target);
+    else done = false;
+    pfree(switchover);
+    return done;
+}
+
+bool standby_switchover(Backend *backend) {
+    char *switchover;
+    if (!RecoveryInProgress() || backend != standby_primary || !(switchover = init_switchover())) return false;
+    pfree(switchover);
+    return !standby_streaming();
+}
+
 void standby_failed(Backend *backend) {
     if (backend->state > state_primary) { backend_finish(backend); return; }
-    if (!backend_nevents()) { init_set_host(backend->host, state_wait_primary); if (kill(PostmasterPid, SIGKILL)) elog(WARNING, "kill(%i, %i)", PostmasterPid, SIGKILL); return; }
+    if (standby_switchover_failed(backend)) return;
+    if (standby_heartbeat()) { elog(WARNING, "%s:%s failed but wal receiver still has heartbeat", backend->host, init_state2char(backend->state)); return; }
+    if (!backend_nevents()) { init_set_host(backend->host, state_wait_primary); if (init_governor()) init_kill(SIGKILL); return; }
     switch (init_state) {
         case state_sync: standby_promote(backend); break;
         case state_potential: if (backend->attempt >= 2 * init_attempt) {
             Backend *sync = backend_state(state_sync);
             if (sync) standby_reprimary(sync);
-            else if (kill(PostmasterPid, SIGKILL)) elog(WARNING, "kill(%i, %i)", PostmasterPid, SIGKILL);
+            else if (init_governor()) init_kill(SIGKILL);
         } break;
         default: ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("unknown init_state = %s", init_state2char(init_state)))); break;
     }
 }
 
 void standby_finished(Backend *backend) {
-    if (backend->state <= state_primary) standby_primary = NULL;
+    if (backend->state > state_primary) return;
+    standby_primary = NULL;
+    standby_listening = false;
+    if (standby_upstream) pfree(standby_upstream);
+    standby_upstream = NULL;
+}
+
+static void standby_listen_result(Backend *backend) {
+    bool ok = false;
+    for (PGresult *result; PQstatus(backend->conn) == CONNECTION_OK && (result = PQgetResult(backend->conn)); ) {
+        switch (PQresultStatus(result)) {
+            case PGRES_COMMAND_OK: ok = true; break;
+            default: elog(WARNING, "%s:%s PQresultStatus = %s and %s", backend->host, init_state2char(backend->state), PQresStatus(PQresultStatus(result)), PQresultErrorMessageMy(result)); break;
+        }
+        PQclear(result);
+    }
+    if (PQstatus(backend->conn) != CONNECTION_OK) return;
+    standby_listening = ok;
+    standby_select(backend);
+}
+
+static void standby_listen(Backend *backend) {
+    backend->socket = standby_listen;
+    if (!PQsendQuery(backend->conn, SQL(LISTEN pg_save))) { elog(WARNING, "%s:%s !PQsendQuery and %s", backend->host, init_state2char(backend->state), PQerrorMessageMy(backend->conn)); backend_finish(backend); return; }
+    backend->socket = standby_listen_result;
+    backend->event = WL_SOCKET_READABLE;
+}
+
+void standby_notified(Backend *backend) {
+    if (backend != standby_primary) return;
+    standby_select(backend);
 }
 
 void standby_fini(void) {
+    if (standby_upstream) pfree(standby_upstream);
+    standby_upstream = NULL;
 }
 
 void standby_init(void) {
@@ -85,19 +229,96 @@ void standby_init(void) {
         case state_wait_standby: break;
         default: ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("unknown init_state = %s", init_state2char(init_state)))); break;
     }
-#if PG_VERSION_NUM >= 120000
-    if (!standby_primary) standby_create(PrimaryConnInfo);
+    if (!standby_primary) standby_create_primary();
+    INSTR_TIME_SET_CURRENT(standby_contact);
+}
+
+static void standby_resync(TimeLineID timeline_id, TimeLineID replay_tli, XLogRecPtr replay_lsn) {
+    FILE *file;
+    if (standby_resyncing) return;
+    journal_write(journal_resync, NULL, init_state, timeline_id, NULL);
+    elog(WARNING, "timeline %u at %X/%X diverged from primary timeline %u", replay_tli, (uint32)(replay_lsn >> 32), (uint32)replay_lsn, timeline_id);
+    if (!(file = AllocateFile("pg_save.resync", "w"))) { ereport(WARNING, (errcode_for_file_access(), errmsg("could not create file \"%s\": %m", "pg_save.resync"))); return; }
+    FreeFile(file);
+    standby_resyncing = true;
+    init_kill(SIGINT);
+}
+
+static bool standby_identify(Backend *backend, PGresult *result) {
+    TimeLineID replay_tli;
+    TimeLineID timeline_id = strtoul(PQgetvalue(result, 0, PQfnumber(result, "timeline_id")), NULL, 10);
+    uint64 system_identifier = strtoull(PQgetvalue(result, 0, PQfnumber(result, "system_identifier")), NULL, 10);
+    XLogRecPtr replay_lsn = GetXLogReplayRecPtr(&replay_tli);
+    if (system_identifier != GetSystemIdentifier()) { elog(WARNING, "%s:%s system_identifier = " UINT64_FORMAT " != " UINT64_FORMAT, backend->host, init_state2char(backend->state), system_identifier, GetSystemIdentifier()); return false; }
+    if (timeline_id == replay_tli) return true;
+    if (timeline_id > replay_tli && !PQgetisnull(result, 0, PQfnumber(result, "history"))) {
+        for (char *line = PQgetvalue(result, 0, PQfnumber(result, "history")); line && *line; line = (line = strchr(line, '\n')) ? line + 1 : NULL) {
+            TimeLineID tli;
+            uint32 hi, lo;
+            if (sscanf(line, "%u\t%X/%X", &tli, &hi, &lo) != 3) continue;
+            if (tli != replay_tli) continue;
+            if (replay_lsn <= ((uint64)hi << 32 | lo)) return true;
+            break;
+        }
+    }
+    standby_resync(timeline_id, replay_tli, replay_lsn);
+    return false;
+}
+
+static void standby_cascade(Backend *backend, const char *upstream) {
+#if PG_VERSION_NUM >= 130000
+    StringInfoData buf;
+    initStringInfoMy(save_context, &buf);
+    if (upstream) appendStringInfo(&buf, "host=%s application_name=%s", upstream, hostname);
+    else appendStringInfo(&buf, "host=%s application_name=%s target_session_attrs=read-write", backend->host, hostname);
+    if (strcmp(buf.data, PrimaryConnInfo)) {
+        elog(LOG, "cascade from %s", upstream ? upstream : backend->host);
+        init_set_system("primary_conninfo", buf.data);
+    }
+    pfree(buf.data);
+    if (upstream && standby_upstream && !strcmp(upstream, standby_upstream)) return;
+    if (standby_upstream) pfree(standby_upstream);
+    standby_upstream = upstream ? MemoryContextStrdup(backend_context, upstream) : NULL;
 #endif
 }
 
 static void standby_result(Backend *backend, PGresult *result) {
+    int application_name = PQfnumber(result, "application_name");
+    int archiver = PQfnumber(result, "archiver");
+    int lag = PQfnumber(result, "lag");
+    int ntuples = 0;
+    int potential = 0;
+    int sync_state = PQfnumber(result, "sync_state");
+    const char *current = NULL;
+    const char *upstream = NULL;
+    double score = 0;
+    uint32 seed = init_hash(hostname, 2166136261);
+    uint64 limit = (uint64)init_cascade_lag * 1024;
+    if (!standby_identify(backend, result)) return;
+    if (archiver >= 0 && PQntuples(result) && !PQgetisnull(result, 0, archiver)) init_set_archiver(PQgetvalue(result, 0, archiver));
     for (int row = 0; row < PQntuples(result); row++) {
-        const char *host = PQgetvalue(result, row, PQfnumber(result, "application_name"));
-        const char *state = PQgetvalue(result, row, PQfnumber(result, "sync_state"));
-        backend_result(host, init_char2state(state));
+        const char *host;
+        double weight;
+        state_t state;
+        uint64 bytes;
+        if (PQgetisnull(result, row, application_name)) continue;
+        host = PQgetvalue(result, row, application_name);
+        state = init_char2state(PQgetvalue(result, row, sync_state));
+        backend_result(host, state);
+        ntuples++;
+        if (state == state_potential || state == state_quorum) potential++;
+        if (state != state_sync && state != state_potential && state != state_quorum) continue;
+        if (!strcmp(host, hostname) || PQgetisnull(result, row, lag)) continue;
+        bytes = strtoull(PQgetvalue(result, row, lag), NULL, 10);
+        if (standby_upstream && !strcmp(host, standby_upstream) && bytes <= 2 * limit) current = host;
+        if (bytes > limit) continue;
+        weight = -1.0 / ((1.0 + (double)bytes / Max(limit, 1)) * log(((double)init_hash(host, seed) + 1.0) / 4294967297.0));
+        if (!upstream || weight > score) { upstream = host; score = weight; }
     }
-    backend_update(backend, PQntuples(result) ? state_primary : state_wait_primary);
-    if (!PQntuples(result)) switch (init_state) {
+    if (current) upstream = current;
+    if (init_state == state_async && init_cascade_lag) standby_cascade(backend, potential ? upstream : NULL);
+    backend_update(backend, ntuples ? state_primary : state_wait_primary);
+    if (!ntuples) switch (init_state) {
         case state_async: init_set_state(state_wait_standby); break;
         case state_potential: init_set_state(state_wait_standby); break;
         case state_quorum: init_set_state(state_wait_standby); break;
@@ -125,22 +346,44 @@ static void standby_select_result(Backend *backend) {
         }
         PQclear(result);
     }
-    if (ok) backend_idle(backend);
+    if (ok && prewarm_due()) prewarm_select(backend);
+    else if (ok) backend_idle(backend);
     else if (PQstatus(backend->conn) == CONNECTION_OK) backend_finish(backend);
 }
 
 static void standby_select(Backend *backend) {
+    char replay_tli[MAXINT8LEN + 1];
+    const char *values[] = {replay_tli};
+    TimeLineID tli;
+    GetXLogReplayRecPtr(&tli);
+    snprintf(replay_tli, sizeof(replay_tli), "%u", tli);
     backend->socket = standby_select;
-    if (!PQsendQuery(backend->conn, SQL(SELECT * FROM pg_stat_replication WHERE state = 'streaming' AND NOT EXISTS (SELECT * FROM pg_stat_progress_basebackup)))) { elog(WARNING, "%s:%s !PQsendQuery and %s", backend->host, init_state2char(backend->state), PQerrorMessageMy(backend->conn)); backend_finish(backend); return; }
+    if (!PQsendQueryParams(backend->conn, SQL(
+        SELECT s.system_identifier, t.timeline_id, CASE WHEN t.timeline_id > $1::integer THEN pg_read_file('pg_wal/' || lpad(upper(to_hex(t.timeline_id)), 8, '0') || '.history', 0, 1048576, true) END AS history, pg_wal_lsn_diff(pg_current_wal_lsn(), r.replay_lsn)::bigint AS lag, pg_save_archiver() AS archiver, r.*
+        FROM pg_control_system() AS s
+        CROSS JOIN (SELECT ('x' || substr(pg_walfile_name(pg_current_wal_lsn()), 1, 8))::bit(32)::integer AS timeline_id) AS t
+        LEFT JOIN pg_stat_replication AS r ON r.state = 'streaming' AND NOT EXISTS (SELECT * FROM pg_stat_progress_basebackup)
+    ), countof(values), NULL, values, NULL, NULL, false)) { elog(WARNING, "%s:%s !PQsendQueryParams and %s", backend->host, init_state2char(backend->state), PQerrorMessageMy(backend->conn)); backend_finish(backend); return; }
     backend->socket = standby_select_result;
     backend->event = WL_SOCKET_READABLE;
 }
 
 void standby_timeout(void) {
-#if PG_VERSION_NUM >= 120000
-    if (!standby_primary) standby_create(PrimaryConnInfo);
-#endif
-    if (PQstatus(standby_primary->conn) == CONNECTION_OK) standby_select(standby_primary);
+    long lease = standby_lease();
+    if (!standby_primary) standby_create_primary();
+    if (!standby_primary) return;
+    if (init_lease && init_state == state_sync && lease > 0 && PQstatus(standby_primary->conn) != CONNECTION_OK && !standby_heartbeat()) {
+        elog(WARNING, "%s:%s lease expired %li ms ago", standby_primary->host, init_state2char(standby_primary->state), lease);
+        journal_write(journal_lease, standby_primary->host, init_state, 0, "expired");
+        standby_failed(standby_primary);
+        return;
+    }
+    if (PQstatus(standby_primary->conn) == CONNECTION_OK && backend_idling(standby_primary) && !standby_listening) standby_listen(standby_primary);
+    else if (PQstatus(standby_primary->conn) == CONNECTION_OK && !standby_heartbeat()) {
+        if (backend_idling(standby_primary)) standby_select(standby_primary);
+        else if (standby_primary->socket == standby_select_result) { elog(WARNING, "%s:%s no heartbeat and no probe result", standby_primary->host, init_state2char(standby_primary->state)); backend_reset(standby_primary); }
+    }
+    prewarm_timeout();
 }
 
 void standby_updated(Backend *backend) {